@@ -32,22 +32,34 @@ class ExInpaint : public GenericVideoFilter {
 	int ysize;
 	int radius;
 	int maxsteps;
+	int mode;
+	int iterations;
+	int coherence;
+	int stride;
+	int accept;
+	int minradius;
+	PClip areaclip;
 
 	inpainting *inp;
 	unsigned char * bufferYUV;
 	unsigned char * buffermaskYUV; // mask
+	unsigned char * bufferareaYUV; // source area
 	int buffer_pitch;
 
 public:
 
-	ExInpaint(PClip _child,  PClip _maskclip, int _color, int _dilate, int _xsize, int _ysize, int _radius, int _maxsteps, IScriptEnvironment* env);
+	ExInpaint(PClip _child,  PClip _maskclip, int _color, int _dilate, int _xsize, int _ysize, int _radius, int _maxsteps,
+			  const char * _mode, int _iterations, int _coherence, int _stride,
+			  int _accept, int _minradius, PClip _areaclip, IScriptEnvironment* env);
   ~ExInpaint();
 	PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
 };
 
 
 //Here is the acutal constructor code used
-ExInpaint::ExInpaint(PClip _child, PClip _maskclip, int _color, int _dilate, int _xsize, int _ysize, int _radius, int _maxsteps, IScriptEnvironment* env):
+ExInpaint::ExInpaint(PClip _child, PClip _maskclip, int _color, int _dilate, int _xsize, int _ysize, int _radius, int _maxsteps,
+					 const char * _mode, int _iterations, int _coherence, int _stride,
+					 int _accept, int _minradius, PClip _areaclip, IScriptEnvironment* env):
 	GenericVideoFilter(_child),
 	maskclip(_maskclip),
 	color(_color),
@@ -56,9 +68,16 @@ ExInpaint::ExInpaint(PClip _child, PClip _maskclip, int _color, int _dilate, int
 	ysize(_ysize),
 	radius(_radius),
 	maxsteps(_maxsteps),
+	iterations(_iterations),
+	coherence(_coherence),
+	stride(_stride),
+	accept(_accept),
+	minradius(_minradius),
+	areaclip(_areaclip),
 	inp(nullptr),
 	bufferYUV(nullptr),
-	buffermaskYUV(nullptr)
+	buffermaskYUV(nullptr),
+	bufferareaYUV(nullptr)
 {
   // This is the implementation of the constructor.
   // The child clip (source clip) is inherited by the GenericVideoFilter,
@@ -104,11 +123,63 @@ ExInpaint::ExInpaint(PClip _child, PClip _maskclip, int _color, int _dilate, int
 
 //	masklast = maskvi.num_frames;
 
+	if (lstrcmpi(_mode, "exact") == 0)
+		mode = SEARCH_EXACT;
+	else if (lstrcmpi(_mode, "patchmatch") == 0)
+		mode = SEARCH_PATCHMATCH;
+	else if (lstrcmpi(_mode, "ann") == 0)
+		mode = SEARCH_ANN;
+	else if (lstrcmpi(_mode, "fft") == 0)
+		mode = SEARCH_FFT;
+	else if (lstrcmpi(_mode, "pyramid") == 0)
+		mode = SEARCH_PYRAMID;
+	else if (lstrcmpi(_mode, "spiral") == 0)
+		mode = SEARCH_SPIRAL;
+	else if (lstrcmpi(_mode, "luma") == 0)
+		mode = SEARCH_LUMA;
+	else
+		env->ThrowError("ExInpaint: mode must be \"exact\", \"patchmatch\", \"ann\", \"fft\", \"pyramid\", \"spiral\" or \"luma\"!");
+
+	if (iterations < 0)
+		env->ThrowError("ExInpaint: iterations must not be negative!");
+
+	if (coherence < 0)
+		env->ThrowError("ExInpaint: coherence must not be negative!");
+
+	if (stride < 1)
+		env->ThrowError("ExInpaint: stride must be positive!");
+
+	if (accept < 0)
+		env->ThrowError("ExInpaint: accept must not be negative!");
+
+	if (minradius < 0)
+		env->ThrowError("ExInpaint: minradius must not be negative!");
+
+	if (areaclip)
+	{
+		VideoInfo areavi = areaclip->GetVideoInfo();
+
+		if (vi.width != areavi.width || vi.height != areavi.height )
+			env->ThrowError("ExInpaint: source area size %d x %d is not as source clip size",areavi.width,areavi.height);
+
+		if (vi.pixel_type != areavi.pixel_type)
+			env->ThrowError("ExInpaint: source area pixel type must be same as source clip type!");
+
+		if (vi.IsYUY2())
+			bufferareaYUV = new unsigned char [vi.height * buffer_pitch+16];
+	}
+
 // warning:
 //    if (!(xsize%2 && ysize%2))
 //		env->ThrowError("ExInpaint: xsize, ysize must be odd (3,5,7,9...)!");
 
 	inp = new inpainting(vi.width, vi.height, pixel_format);
+	inp->search_mode = mode;
+	inp->iterations = iterations;
+	inp->coherence = coherence;
+	inp->stride = stride;
+	inp->accept = accept;
+	inp->minradius = minradius;
 
 }
 //-------------------------------------------------------------------------------------------
@@ -118,6 +189,7 @@ ExInpaint::~ExInpaint() {
 	delete inp;
 	delete [] bufferYUV;
 	delete [] buffermaskYUV;
+	delete [] bufferareaYUV;
 }
 
 
@@ -289,6 +361,24 @@ PVideoFrame __stdcall ExInpaint::GetFrame(int n, IScriptEnvironment* env) {
 	if (maskclip)
         maskframe = maskclip->GetFrame(n, env); // mask frame must be first to avoid makewritable bug
 
+	PVideoFrame areaframe;
+	if (areaclip)
+	{
+		areaframe = areaclip->GetFrame(n, env);
+		if (vi.IsYUY2())
+		{
+			convertYUY2toYUV24(areaframe->GetReadPtr(), areaframe->GetPitch(), areaframe->GetRowSize(), areaframe->GetHeight(),
+				bufferareaYUV, buffer_pitch);
+			inp->psrcarea = bufferareaYUV;
+			inp->srcarea_pitch = buffer_pitch;
+		}
+		else
+		{
+			inp->psrcarea = areaframe->GetReadPtr(); // luma plane for YV12
+			inp->srcarea_pitch = areaframe->GetPitch();
+		}
+	}
+
 	PVideoFrame src = child->GetFrame(n, env);// Request frame 'n' from the child (source) clip.
 
 	env->MakeWritable(&src); // will get results inplace
@@ -364,6 +454,13 @@ AVSValue __cdecl Create_ExInpaint(AVSValue args, void* user_data, IScriptEnviron
 		 args[5].AsInt(8), // parameter ysize
 		 args[6].AsInt(0), // parameter search radius
 		 args[7].AsInt(100000), // parameter max steps
+		 args[8].AsString("exact"), // parameter search mode
+		 args[9].AsInt(20), // parameter PatchMatch iterations
+		 args[10].AsInt(0), // parameter coherence threshold
+		 args[11].AsInt(1), // parameter stride
+		 args[12].AsInt(0), // parameter accept threshold
+		 args[13].AsInt(0), // parameter initial adaptive radius
+		 args[14].Defined() ? args[14].AsClip() : 0, // parameter source area
 		 env);
     // Calls the constructor with the arguments provied.
 }
@@ -379,7 +476,7 @@ extern "C" __declspec(dllexport)
 const char * __stdcall AvisynthPluginInit3(IScriptEnvironment *env, const AVS_Linkage *const vectors)
 {
 	AVS_linkage = vectors;
-    env->AddFunction("ExInpaint", "c[mask]c[color]i[dilate]i[xsize]i[ysize]i[radius]i[steps]i", Create_ExInpaint, 0);
+    env->AddFunction("ExInpaint", "c[mask]c[color]i[dilate]i[xsize]i[ysize]i[radius]i[steps]i[mode]s[iterations]i[coherence]i[stride]i[accept]i[minradius]i[source]c", Create_ExInpaint, 0);
     // The AddFunction has the following parameters:
     // AddFunction(Filtername , Arguments, Function to call,0);
 
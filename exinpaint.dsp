@@ -99,6 +99,10 @@ SOURCE=.\exinpaint.cpp
 
 SOURCE=.\inpainting.cpp
 # End Source File
+# Begin Source File
+
+SOURCE=.\sad.cpp
+# End Source File
 # End Group
 # Begin Group "Header Files"
 
@@ -111,6 +115,10 @@ SOURCE=.\avisynth.h
 
 SOURCE=.\inpainting.h
 # End Source File
+# Begin Source File
+
+SOURCE=.\sad.h
+# End Source File
 # End Group
 # Begin Group "Resource Files"
 
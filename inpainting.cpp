@@ -46,6 +46,34 @@ v0.2 at 13-26 January 2008 by Fizick:
  - added YUY2 format and YUV24
  - added dilation of mask
 
+v0.3:
+ - SSE2/AVX2/AVX-512 intrinsic SAD kernels of PatchTexture selected at runtime by CPUID (instead of MMX assembler)
+ - partial distance (row-wise) early termination of SAD in PatchTexture with good candidates tried first
+ - successive elimination (SEA) lower bound of SAD by integral images of channels
+ - per search cache of premasked target rows for RGB formats, whole rows are compared by simple byte SAD
+ - approximate PatchMatch search mode with nearest neighbour field (mode, iterations parameters)
+ - coherent candidates (shifted sources of filled pixels of target patch) are tried first, search is skipped if good (coherence parameter)
+ - approximate nearest neighbour search mode by kd-tree of PCA projected patch descriptors with exact re-ranking
+ - FFT search mode by SSD (masked correlation) in tiles of search area, if it is cheaper than exact search
+ - coarse to fine (pyramid) search mode
+ - strided scan with refinement around best candidates (stride parameter)
+ - spiral search mode, stopped by good enough patch (accept parameter)
+ - adaptive search radius, enlarged from minradius only if search area has no valid source patch
+ - automatic search radius is estimated for every hole (connected target area) separately, by linear cost erosion
+ - luma first search mode, only few best patches by luma are compared by colour
+ - YV12 chroma is compared at chroma resolution (once per chroma sample) by cached rows
+ - mark and confidence maps with apron (OUTSIDE marks) around frame, loops near patch do not check frame borders
+ - search loops iterate over runs of valid source centres (found by binary search in row) instead of all pixels
+ - exact search area is scanned by cache sized tiles of columns, target patch cache is aligned
+ - optional source area clip restricts exemplars, search area is shrunk to its bounding box
+ - interleaved formats are compared by planar (de-interleaved once per frame) aligned working copy
+ - indexed max-heap of boundary pixels by priority instead of full scans, true global max at every step
+ - counter of target pixels left and boundary update from filled pixels only, instead of rescans
+ - confidence window sums of large patches by 2D Fenwick tree
+ - data term of large patches by gradient maps with sliding window (van Herk/Gil-Werman) max, updated around filled patch only
+ - fixed gradients of YV12 (gray is copy of luma, instead of plane with pitch indexed by width)
+ - priority is updated for all boundary pixels whose patch intersects changed area, and only for them
+
 */
 
 #include "inpainting.h"
@@ -57,30 +85,144 @@ v0.2 at 13-26 January 2008 by Fizick:
 #define MAX(a, b)  (((a) > (b)) ? (a) : (b))
 #define MIN(a, b)  (((a) < (b)) ? (a) : (b))
 
+#define MIN_INITIAL 99999999
+
+#define IS_TARGET(mark) ((mark) & (TARGET|BOUNDARY)) // target or boundary, not source nor outside
+
 inpainting::inpainting(int _width, int _height, int _pixel_format)
 {
 	m_width = _width;
 	m_height = _height;
 	pixel_format = _pixel_format;
 
-	m_mark = new unsigned char[m_width*m_height];
-	m_confid = new int[m_width*m_height];
+	sad_getkernels(&sad, sad_cpulevel()); // select SIMD by CPUID
+
+	m_markbuf = 0; // allocated for patch size
+	m_confidbuf = 0;
+	m_mark = 0;
+	m_confid = 0;
+	m_apron = -1;
 	m_pri = new int[m_width*m_height];
+	m_heap = new int[m_width*m_height];
+	m_gradrow = new long long[m_width*m_height];
+	m_gradmax = new long long[m_width*m_height];
+	m_slidebuf = 0;
+	m_usegradmap = false;
+	m_fenwick = new unsigned int[(m_width+1)*(m_height+1)];
+	m_usefenwick = false;
+	m_heappos = new int[m_width*m_height];
+	m_nheap = 0;
 	m_source = new unsigned char[m_width*m_height];
-
-	if(pixel_format == RGB32 || pixel_format == RGB24 || pixel_format == RGBA || pixel_format == YUY2 || pixel_format == YUV24)
-		m_gray  = new unsigned char[m_width*m_height];
+	m_runs = new int[(m_width+1)*m_height]; // at most (m_width+1)/2 runs in row
+	m_rowruns = new int[m_height+1];
+	m_rows = new int[m_height];
+	m_rowknown = new int[m_height];
+	m_crows = new int[m_height];
+	m_sat = new unsigned int[(m_width+1)*(m_height+1)*3];
+	m_graysat = 0;
+	m_blocks = 0;
+	m_csamples = 0;
+	m_maxblocks = 0;
+	m_tcachebuf = 0;
+	m_mcachebuf = 0;
+	m_tcache = 0;
+	m_mcache = 0;
+	m_tcache_pitch = 0;
+	m_gcache = 0;
+	m_gmcache = 0;
+	m_gy0 = m_gny = 0;
+	m_nnf = new int[m_width*m_height];
+	m_hole = new int[m_width*m_height];
+	m_holequeue = new int[m_width*m_height];
+	m_holeradius = 0;
+	m_nholes = 0;
+	m_maxholes = 0;
+	m_coherent = 0;
+	m_filled = 0;
+	m_nfilled = 0;
+	m_ntargets = 0;
+	m_ann_count = -1;
+	m_ann_index = 0;
+	m_ann_points = 0;
+	m_ann_split = 0;
+	m_fft_n = 0;
+	m_fft_tx = m_fft_ty = 0;
+	m_fft_tile = 0;
+	m_fft_done = 0;
+	m_fft_t1 = 0;
+	m_fft_t2 = 0;
+	m_fft_corr = 0;
+	m_fft_roots = 0;
+	m_pyr = 0;
+	m_pyr_mark = 0;
+	search_mode = SEARCH_EXACT;
+	iterations = 20;
+	coherence = 0;
+	stride = 1;
+	accept = 0;
+	minradius = 0;
+	psrcarea = 0;
+	srcarea_pitch = 0;
+
+	m_gray  = new unsigned char[m_width*m_height]; // copy of luma for YV12 too, since gradients index it by width
+
+	m_planebuf = 0;
+	m_planes = 0;
+	m_ppitch = 0;
+	if(pixel_format == RGB32 || pixel_format == RGB24 || pixel_format == RGBA || pixel_format == YUV24)
+	{
+		m_ppitch = (m_width + 63) & ~63;
+		m_planebuf = new unsigned char[m_ppitch*3*m_height + 64];
+		m_planes = m_planebuf + (64 - ((size_t)m_planebuf & 63)); // aligned to cache line
+	}
 
 }
 
 
 inpainting::~inpainting(void)
 {
-	if(m_mark)delete [] m_mark;
-	if(m_confid)delete [] m_confid;
+	if(m_markbuf)delete [] m_markbuf;
+	if(m_confidbuf)delete [] m_confidbuf;
 	if(m_pri)delete [] m_pri;
+	if(m_heap)delete [] m_heap;
+	if(m_gradrow)delete [] m_gradrow;
+	if(m_gradmax)delete [] m_gradmax;
+	if(m_slidebuf)delete [] m_slidebuf;
+	if(m_fenwick)delete [] m_fenwick;
+	if(m_heappos)delete [] m_heappos;
 	if(m_source)delete [] m_source;
-	if(m_gray && pixel_format != YV12 )delete [] m_gray;
+	if(m_runs)delete [] m_runs;
+	if(m_rowruns)delete [] m_rowruns;
+	if(m_rows)delete [] m_rows;
+	if(m_rowknown)delete [] m_rowknown;
+	if(m_crows)delete [] m_crows;
+	if(m_sat)delete [] m_sat;
+	if(m_graysat)delete [] m_graysat;
+	if(m_planebuf)delete [] m_planebuf;
+	if(m_blocks)delete [] m_blocks;
+	if(m_csamples)delete [] m_csamples;
+	if(m_tcachebuf)delete [] m_tcachebuf;
+	if(m_mcachebuf)delete [] m_mcachebuf;
+	if(m_nnf)delete [] m_nnf;
+	if(m_hole)delete [] m_hole;
+	if(m_holequeue)delete [] m_holequeue;
+	if(m_holeradius)delete [] m_holeradius;
+	if(m_coherent)delete [] m_coherent;
+	if(m_filled)delete [] m_filled;
+	if(m_ann_index)delete [] m_ann_index;
+	if(m_ann_points)delete [] m_ann_points;
+	if(m_ann_split)delete [] m_ann_split;
+	for(int t = 0; t<m_fft_tx*m_fft_ty && m_fft_tile; t++)
+		if(m_fft_tile[t])delete [] m_fft_tile[t];
+	if(m_fft_tile)delete [] m_fft_tile;
+	if(m_fft_done)delete [] m_fft_done;
+	if(m_fft_t1)delete [] m_fft_t1;
+	if(m_fft_t2)delete [] m_fft_t2;
+	if(m_fft_corr)delete [] m_fft_corr;
+	if(m_fft_roots)delete [] m_fft_roots;
+	if(m_pyr)delete [] m_pyr;
+	if(m_pyr_mark)delete [] m_pyr_mark;
+	if(m_gray)delete [] m_gray;
 }
 
 
@@ -124,6 +266,39 @@ int inpainting::process3planes(unsigned char * _psrc, int _src_pitch,
 	winxsize = _xsize/2; // window is half of full side size
 	winysize = _ysize/2;
 	radius = _radius; // 0 for auto search, radius > size
+	if (m_maxblocks < (winysize*3)*(winxsize+1)) // max number of runs in patch (and chroma runs for YV12)
+	{
+		delete [] m_blocks;
+		m_maxblocks = (winysize*3)*(winxsize+1);
+		m_blocks = new block[m_maxblocks];
+		delete [] m_csamples;
+		m_csamples = new csample[m_maxblocks]; // (winysize)*(winxsize) chroma samples
+		delete [] m_tcachebuf;
+		delete [] m_mcachebuf;
+		m_tcachebuf = new unsigned char[m_maxblocks*8 + 64]; // (winysize*2) rows of (winxsize*2) pixels by 4 bytes
+		m_mcachebuf = new unsigned char[m_maxblocks*8 + 64];
+		m_tcache = m_tcachebuf + (64 - ((size_t)m_tcachebuf & 63)); // aligned to cache line
+		m_mcache = m_mcachebuf + (64 - ((size_t)m_mcachebuf & 63));
+		m_gcache = m_tcache + m_maxblocks*4; // (winysize*2) rows of (winxsize*2) gray pixels, after 3 planes rows
+		m_gmcache = m_mcache + m_maxblocks*4;
+		delete [] m_coherent;
+		m_coherent = new int[m_maxblocks*2]; // (winysize*2)*(winxsize*2) pixels
+		delete [] m_filled;
+		m_filled = new int[m_maxblocks*2];
+	}
+	if (m_apron < MAX(winxsize, winysize) + 3) // apron for all loops around patch
+	{
+		delete [] m_markbuf;
+		delete [] m_confidbuf;
+		m_apron = MAX(winxsize, winysize) + 3;
+		m_mpitch = m_width + m_apron*2;
+		m_markbuf = new unsigned char[m_mpitch*(m_height + m_apron*2)];
+		m_confidbuf = new int[m_mpitch*(m_height + m_apron*2)];
+		m_mark = m_markbuf + m_apron*m_mpitch + m_apron;
+		m_confid = m_confidbuf + m_apron*m_mpitch + m_apron;
+		delete [] m_slidebuf;
+		m_slidebuf = new long long[(MAX(m_width, m_height) + m_apron*2)*3]; // row or column with window
+	}
 	maskcolor = _maskcolor;
 	dilateflags = _dilateflags;
 
@@ -132,12 +307,18 @@ int inpainting::process3planes(unsigned char * _psrc, int _src_pitch,
 	m_left = m_width;
 	m_right = 0;
 
+	if (search_mode == SEARCH_LUMA && m_graysat == 0)
+		m_graysat = new unsigned int[(m_width+1)*(m_height+1)];
 	Convert2Gray();  // create  gray image from RGB source
-	memset( m_confid, 0, m_width*m_height*sizeof(int) ); // init
+	SplitPlanes(); // and planes for SAD
+	Integrate(); // and integral images of channels
+	memset(m_markbuf, OUTSIDE, m_mpitch*(m_height + m_apron*2)); // init apron, frame is set by GetMask
+	memset(m_confidbuf, 0, m_mpitch*(m_height + m_apron*2)*sizeof(int));
 	GetMask();
 	if (dilateflags)
         Dilate(dilateflags);
 	//char buf[80];
+	m_nholes = 0; // no own radius of holes
 	if (radius==0)
 	{
 		radius = EstimateRadius(); // first approximation
@@ -146,21 +327,47 @@ int inpainting::process3planes(unsigned char * _psrc, int _src_pitch,
 		radius = MAX((radius + 5), ((MIN(winxsize, winysize)) * 4)); // semi-empirical min estimation
 	//wsprintf(buf,"ExInpaint: radius=%d", radius);
 	//OutputDebugString(buf);
+		for(int h = 0; h<m_nholes; h++) // same for every hole (0 - full frame if not eroded)
+			if(m_holeradius[h]>0)
+				m_holeradius[h] = MAX((m_holeradius[h] + 5), ((MIN(winxsize, winysize)) * 4));
 	}
 	DrawBoundary();  // first time draw boundary
+	BuildFenwick(); // confidence is ready
+	// and gradient maps, if their per frame cost is less than scans of large patches.
+	// They are needed in patches of boundary pixels only (others are none, not to be used)
+	m_usegradmap = ((winxsize*2)*(winysize*2) >= 256);
+	if (m_usegradmap)
+	{
+		memset(m_gradrow, -1, m_width*m_height*sizeof(long long));
+		GradientMap(m_left-winxsize-1, m_top-winysize-1, m_right+winxsize+2, m_bottom+winysize+2);
+	}
 	draw_source();   // find the patches that can be used as sample texture
+	m_ann_count = -1; // index of them is not built yet
+	if (search_mode == SEARCH_FFT)
+		FftInit(); // and spectra of its tiles are not computed
+	m_pyr_ready = false; // and coarse frame
+	m_pyr_scale = (MIN(winxsize, winysize)>=8) ? 4 : 2;
 	memset(m_pri, 0, m_width*m_height*sizeof(int));
+	memset(m_heappos, -1, m_width*m_height*sizeof(int));
+	m_nheap = 0;
 	for(int j= m_top; j<=m_bottom; j++)
 	    for(int i = m_left; i<= m_right; i++)
-			if(m_mark[j*m_width+i] == BOUNDARY)
+			if(m_mark[j*m_mpitch+i] == BOUNDARY)
+			{
 				m_pri[j*m_width+i] = priority(i,j);//if it is boundary, calculate the priority
+				m_heappos[j*m_width+i] = m_nheap;
+				m_heap[m_nheap++] = j*m_width+i;
+			}
+	for(int k = m_nheap/2-1; k>=0; k--) // build heap
+		HeapDown(k);
+	m_lastdx = MIN_INITIAL; // no previous patch
+	memset(m_nnf, -1, m_width*m_height*sizeof(int)); // unknown field
+	m_random = 1;
 	int count=0;
-	max_pri = -1; // init as not ready
+	max_pri = HighestPriority(); // get pri_x. pri_y
 	while(TargetExist() && count<maxsteps)
 	{
 		count++;
-		if (max_pri<0) // if not ready from prev step local updating, do full search
-			max_pri = HighestPriority(); // get new pri_x. pri_y
 //	char buf[80];
 //	wsprintf(buf,"Inpaint: pri_x=%d, pri_y=%d, max_pri=%d", pri_x, pri_y, max_pri);
 //	OutputDebugString(buf);
@@ -171,10 +378,14 @@ int inpainting::process3planes(unsigned char * _psrc, int _src_pitch,
 		if (!found)
 			return count; // patch not found at this step
 		int conf = ComputeConfidence(pri_x,pri_y); // update confidence
+		UpdateField(pri_x, pri_y, patch_x, patch_y); // remember source of pixels to be filled
 		update(pri_x, pri_y, patch_x,patch_y, conf );// inpaint this area
-		UpdateBoundary(pri_x, pri_y); // update boundary near the changed area
-		max_pri = UpdatePri(pri_x, pri_y);  //  update priority near the changed area
-		// if new max>0 then it is ready in patched area as well as new pri_x and pri_y
+		if (m_pyr_ready)
+			UpdatePyramid(pri_x-winxsize, pri_y-winysize, pri_x+winxsize, pri_y+winysize); // and its coarse pixels
+		UpdateBoundary(); // update boundary near the filled pixels
+		if (m_usegradmap)
+			GradientMap(pri_x-winxsize-1, pri_y-winysize-1, pri_x+winxsize+1, pri_y+winysize+1); // filled pixels and their neighbours
+		max_pri = UpdatePri();  //  update priority near the changed area, and get new max with pri_x and pri_y
 	}
 	return count; // number of inpainting steps (iterations)
 }
@@ -214,7 +425,13 @@ void inpainting::Convert2Gray(void)
 		}
 	}
 	else if (pixel_format == YV12)
-		m_gray = psrc; // gray is simply pointer to luma
+	{
+		for(int y = 0; y<m_height; y++) // gray is simply luma
+		{
+			memcpy(m_gray + y*m_width, psrc1, m_width);
+			psrc1 += src_pitch;
+		}
+	}
 	else if (pixel_format == YUY2)
 	{
 		for(int y = 0; y<m_height; y++)
@@ -240,149 +457,132 @@ void inpainting::Convert2Gray(void)
 }
 
 /*********************************************************************/
-int inpainting::EstimateRadius(void)// estimate redius by iterative erosion (Fizick)
+void inpainting::SplitPlanes(void)
 {
+	// copy channels of interleaved formats (except alpha) to separate planes,
+	// so SAD of rows is computed by full width aligned loads for all formats. Filled pixels are updated too
+	if(m_planes == 0)
+		return;
+	int bpp = (pixel_format == RGB24 || pixel_format == YUV24) ? 3 : 4;
+	for(int y = 0; y<m_height; y++)
+	{
+		unsigned char * psrc1 = psrc + y*src_pitch;
+		unsigned char * p0 = m_planes + y*3*m_ppitch;
+		unsigned char * p1 = p0 + m_ppitch;
+		unsigned char * p2 = p1 + m_ppitch;
+		for(int x = 0; x<m_width; x++)
+		{
+			p0[x] = psrc1[x*bpp];
+			p1[x] = psrc1[x*bpp+1];
+			p2[x] = psrc1[x*bpp+2];
+		}
+	}
+}
 
-
-	// assume mark data is SOURCE or TARGET
+/*********************************************************************/
+int inpainting::EstimateRadius(void)// estimate radius of every hole by erosion (Fizick)
+{
+	// assume mark data is SOURCE or TARGET (dilated pixels are target already, so they are eroded too)
 	// temporary set ERODED pixels
 
-	int iter = 0;
-	bool targets_exist;
+	// Every hole (4-connected target area) gets its own erode count, so small holes are not searched with radius of big one.
+	// Erosion is done by breadth-first search from target pixels near source, number of its levels is
+	// the same as number of iterative erosions, but the cost is linear.
+
+	int *queue = m_holequeue; // indexes in mark map, its apron is never target or source
+	int iter = 0; // max for all holes
+	m_nholes = 0;
+	for(int k = 0; k<m_width*m_height; k++)
+		m_hole[k] = -1; // not target or not found yet
 
-	do // erode loops
+	for(int j = 0; j<m_height; j++)
+	for(int i = 0; i<m_width; i++)
 	{
-		iter++;
-		targets_exist = false;
+		if(m_mark[j*m_mpitch+i]!=TARGET || m_hole[j*m_width+i]>=0)
+			continue; // not new hole
 
-		int j= 0;// top
+		if(m_nholes == m_maxholes) // enlarge radius table
 		{
-			int i=0;// leftmost
-			if(m_mark[j*m_width+i]==TARGET)
-			{
-				if (m_mark[j*m_width+i+1]==SOURCE || m_mark[(j+1)*m_width+i]==SOURCE ||
-					m_mark[j*m_width+i+1]==ERODED || m_mark[(j+1)*m_width+i]==ERODED)
-					m_mark[j*m_width+i] = ERODEDNEXT;
-				targets_exist=true;
-			}
-			for(i = 1; i< m_width-1; i++) // middle i
-			{
-				if(m_mark[j*m_width+i]==TARGET)
-				{
-					//if one of the four neighbours is not target (i.e. source or eroded) pixel, then this should be eroded
-					if(	m_mark[j*m_width+i-1]==SOURCE ||
-						m_mark[j*m_width+i+1]==SOURCE || m_mark[(j+1)*m_width+i]==SOURCE ||
-						m_mark[j*m_width+i-1]==ERODED ||
-						m_mark[j*m_width+i+1]==ERODED || m_mark[(j+1)*m_width+i]==ERODED)
-							m_mark[j*m_width+i] = ERODEDNEXT;
-					targets_exist=true;
-				}
-			}
-			i= m_width-1; // rightmost
-			if(m_mark[j*m_width+i]==TARGET)
-			{
-				if(	m_mark[j*m_width+i-1]==SOURCE || m_mark[(j+1)*m_width+i]==SOURCE ||
-					m_mark[j*m_width+i-1]==ERODED || m_mark[(j+1)*m_width+i]==ERODED)
-					m_mark[j*m_width+i] = ERODEDNEXT;
-				targets_exist=true;
-			}
+			m_maxholes = MAX(m_maxholes*2, 64);
+			int *holeradius = new int[m_maxholes];
+			if(m_nholes>0)
+				memcpy(holeradius, m_holeradius, m_nholes*sizeof(int));
+			delete [] m_holeradius;
+			m_holeradius = holeradius;
 		}
 
-		// middle j
-		for(j= 1; j< m_height-1; j++)
+		// collect all pixels of the hole
+		int n = 0;
+		queue[n++] = j*m_mpitch+i;
+		m_hole[j*m_width+i] = m_nholes;
+		for(int q = 0; q<n; q++)
 		{
-			int i=0;// leftmost
-			if(m_mark[j*m_width+i]==TARGET)
-			{
-				if(	m_mark[(j-1)*m_width+i]==SOURCE	||
-					m_mark[j*m_width+i+1]==SOURCE	|| m_mark[(j+1)*m_width+i]==SOURCE ||
-					m_mark[(j-1)*m_width+i]==ERODED	||
-					m_mark[j*m_width+i+1]==ERODED	|| m_mark[(j+1)*m_width+i]==ERODED)
-						m_mark[j*m_width+i] = ERODEDNEXT;
-				targets_exist=true;
-			}
-			for(i = 1; i< m_width-1; i++) // middle
+			int p = queue[q];
+			int neighbour[4] = {p-1, p+1, p-m_mpitch, p+m_mpitch};
+			for(int d = 0; d<4; d++)
 			{
-				if(m_mark[j*m_width+i]==TARGET)
+				if(m_mark[neighbour[d]]!=TARGET)
+					continue;
+				int h = (neighbour[d]/m_mpitch)*m_width + neighbour[d]%m_mpitch; // inside frame
+				if(m_hole[h]<0)
 				{
-					//if one of the four neighbours is not target (i.e. source or eroded) pixel, then this should be eroded
-					if(	m_mark[(j-1)*m_width+i]==SOURCE	|| m_mark[j*m_width+i-1]==SOURCE ||
-						m_mark[j*m_width+i+1]==SOURCE	|| m_mark[(j+1)*m_width+i]==SOURCE ||
-						m_mark[(j-1)*m_width+i]==ERODED	|| m_mark[j*m_width+i-1]==ERODED ||
-						m_mark[j*m_width+i+1]==ERODED	|| m_mark[(j+1)*m_width+i]==ERODED)
-							m_mark[j*m_width+i] = ERODEDNEXT;
-					targets_exist=true;
+					m_hole[h] = m_nholes;
+					queue[n++] = neighbour[d];
 				}
 			}
-			i= m_width-1; // rightmost
-			if(m_mark[j*m_width+i]==TARGET)
-			{
-				if(	m_mark[(j-1)*m_width+i]==SOURCE	|| m_mark[j*m_width+i-1]==SOURCE ||
-					m_mark[(j+1)*m_width+i]==SOURCE ||
-					m_mark[(j-1)*m_width+i]==ERODED	|| m_mark[j*m_width+i-1]==ERODED ||
-					m_mark[(j+1)*m_width+i]==ERODED)
-						m_mark[j*m_width+i] = ERODEDNEXT;
-				targets_exist=true;
-			}
-			// replace ERODENNEXT to ERODED in prev line for next iteration
-			for(i = 0; i< m_width; i++)
-				if(m_mark[(j-1)*m_width+i]==ERODEDNEXT)	m_mark[(j-1)*m_width+i]=ERODED;
 		}
 
+		// first erosion: pixels with source neighbour (queue is reused, they are not after pixels to check)
+		int end = 0;
+		for(int q = 0; q<n; q++)
+		{
+			int p = queue[q];
+			if(m_mark[p-1]==SOURCE || m_mark[p+1]==SOURCE || m_mark[p-m_mpitch]==SOURCE || m_mark[p+m_mpitch]==SOURCE)
+				queue[end++] = p;
+		}
+		for(int q = 0; q<end; q++)
+			m_mark[queue[q]] = ERODED;
 
-		j= m_height-1;// bottom
+		// next erosions: target neighbours of pixels eroded before
+		int count = 0;
+		int start = 0;
+		while(start<end)
 		{
-			int i=0;
-			if(m_mark[j*m_width+i]==TARGET)
-			{
-				if(	m_mark[(j-1)*m_width+i]==SOURCE	|| m_mark[j*m_width+i+1]==SOURCE ||
-					m_mark[(j-1)*m_width+i]==ERODED	|| m_mark[j*m_width+i+1]==ERODED)
-						m_mark[j*m_width+i] = ERODEDNEXT;
-				targets_exist=true;
-			}
-			for(i = 1; i< m_width-1; i++)// middle
-			{
-				if(m_mark[j*m_width+i]==TARGET)
-				{
-					//if one of the four neighbours is not target (i.e. source or eroded) pixel, then this should be eroded
-					if(	m_mark[(j-1)*m_width+i]==SOURCE	|| m_mark[j*m_width+i-1]==SOURCE ||
-						m_mark[j*m_width+i+1]==SOURCE ||
-						m_mark[(j-1)*m_width+i]==ERODED	|| m_mark[j*m_width+i-1]==ERODED ||
-						m_mark[j*m_width+i+1]==ERODED)
-							m_mark[j*m_width+i] = ERODEDNEXT;
-					targets_exist=true;
-				}
-			}
-			i= m_width-1; // rightmost
-			if(m_mark[j*m_width+i]==TARGET)
+			count++;
+			int next = end;
+			for(int q = start; q<end; q++)
 			{
-				if(	m_mark[(j-1)*m_width+i]==SOURCE	|| m_mark[j*m_width+i-1]==SOURCE ||
-					m_mark[(j-1)*m_width+i]==ERODED	|| m_mark[j*m_width+i-1]==ERODED)
-						m_mark[j*m_width+i] = ERODEDNEXT;
-				targets_exist=true;
+				int p = queue[q];
+				if(m_mark[p-1]==TARGET)
+					m_mark[queue[next++] = p-1] = ERODED;
+				if(m_mark[p+1]==TARGET)
+					m_mark[queue[next++] = p+1] = ERODED;
+				if(m_mark[p-m_mpitch]==TARGET)
+					m_mark[queue[next++] = p-m_mpitch] = ERODED;
+				if(m_mark[p+m_mpitch]==TARGET)
+					m_mark[queue[next++] = p+m_mpitch] = ERODED;
 			}
-			// replace ERODENNEXT to ERODED in prev line for next iteration
-			for(i = 0; i< m_width; i++)
-				if(m_mark[(j-1)*m_width+i]==ERODEDNEXT)	m_mark[(j-1)*m_width+i]=ERODED;
-			// replace ERODENNEXT to ERODED in last line for next iteration
-			for(i = 0; i< m_width; i++)
-				if(m_mark[j*m_width+i]==ERODEDNEXT)	m_mark[j*m_width+i]=ERODED;
+			start = end;
+			end = next;
 		}
-	} while (targets_exist);
-
+		// as iterative erosion, count the last loop without targets, 0 if hole is not eroded at all (no source)
+		m_holeradius[m_nholes] = (count>0) ? count+1 : 0;
+		iter = MAX(iter, m_holeradius[m_nholes]);
+		m_nholes++;
+	}
 
-		// restore all ERODED to TARGET
-		for(int j= 0; j< m_height; j++)
+	// restore all ERODED to TARGET
+	for(int j= 0; j< m_height; j++)
+	{
+		for(int i = 0; i< m_width; i++) // middle
 		{
-			for(int i = 0; i< m_width; i++) // middle
-			{
-				if(m_mark[j*m_width+i]==ERODED)
-					m_mark[j*m_width+i]=TARGET;
+			if(m_mark[j*m_mpitch+i]==ERODED)
+				m_mark[j*m_mpitch+i]=TARGET;
 
-			}
 		}
+	}
 
-	return iter; // erode count as a radius
+	return iter; // erode count of largest hole as a radius
 }
 /*********************************************************************/
 void inpainting::Dilate(int dilateflags)// dilate the mask by 1 pixel
@@ -409,7 +609,7 @@ void inpainting::Dilate(int dilateflags)// dilate the mask by 1 pixel
             if(pmark[i]==SOURCE && pmark[i-1]==TARGET)
                 pmark[i] = ERODED;
 
-            pmark += m_width;
+            pmark += m_mpitch;
         }
     }
     
@@ -420,22 +620,22 @@ void inpainting::Dilate(int dilateflags)// dilate the mask by 1 pixel
         int i;
         for(i = 0; i< m_width; i++)
         {
-            if(pmark[i]==SOURCE && pmark[m_width+i]==TARGET)
+            if(pmark[i]==SOURCE && pmark[m_mpitch+i]==TARGET)
                  pmark[i] = ERODED;
         }
-        pmark += m_width;
+        pmark += m_mpitch;
         for(j= 1; j< m_height-1; j++)
         {
             for(i = 0; i< m_width; i++)
             {
-                if(pmark[i]==SOURCE && (pmark[m_width+i]==TARGET || pmark[-m_width+i]==TARGET) )
+                if(pmark[i]==SOURCE && (pmark[m_mpitch+i]==TARGET || pmark[-m_mpitch+i]==TARGET) )
                     pmark[i] = ERODED;
             }
-            pmark += m_width;
+            pmark += m_mpitch;
         }
         for(i = 0; i< m_width; i++)
         {
-            if(pmark[i]==SOURCE && pmark[-m_width+i]==TARGET)
+            if(pmark[i]==SOURCE && pmark[-m_mpitch+i]==TARGET)
                 pmark[i] = ERODED;
         }
     }
@@ -450,7 +650,7 @@ void inpainting::Dilate(int dilateflags)// dilate the mask by 1 pixel
 				if(pmark[i]==ERODED)
 					pmark[i]=TARGET;
 			}
-            pmark[j] += m_width;
+            pmark += m_mpitch;
 		}
 	}
 
@@ -461,37 +661,89 @@ void inpainting::Dilate(int dilateflags)// dilate the mask by 1 pixel
 /*********************************************************************/
 int inpainting::HighestPriority()
 {
-	// find the boundary pixel with highest priority
-	int max_pri1 = -1; // local,  m_pri may be 0 in flat regions (Fizick)
-
-	unsigned char* pmark = m_mark + m_width*m_top + m_left; // pointers
-	int * ppri = m_pri + m_width*m_top + m_left;
-
-	int pri_x1 = 0; // local vars
-	int pri_y1 = 0;
+	// the boundary pixel with highest priority (first in raster order for equal) is the top of heap
+	if (m_nheap == 0)
+		return -1; // no boundary
+	pri_x = m_heap[0]%m_width;
+	pri_y = m_heap[0]/m_width;
+	return m_pri[m_heap[0]];
+}
 
-	int jm = m_bottom - m_top+1;
-	int im = m_right - m_left+1;
+/*********************************************************************/
+void inpainting::HeapUp(int k)
+{
+	int n = m_heap[k];
+	while (k>0)
+	{
+		int parent = (k-1)/2;
+		int p = m_heap[parent];
+		if (m_pri[p]>m_pri[n] || (m_pri[p]==m_pri[n] && p<n))
+			break; // parent is higher
+		m_heap[k] = p;
+		m_heappos[p] = k;
+		k = parent;
+	}
+	m_heap[k] = n;
+	m_heappos[n] = k;
+}
 
-	for(int j= 0; j<jm; j++)
+/*********************************************************************/
+void inpainting::HeapDown(int k)
+{
+	int n = m_heap[k];
+	for(;;)
 	{
-	    for(int i = 0; i< im; i++)
+		int child = k*2+1;
+		if (child>=m_nheap)
+			break;
+		int c = m_heap[child];
+		if (child+1<m_nheap) // higher of two children
 		{
-			if(pmark[i] == BOUNDARY && ppri[i]>max_pri1)
+			int c2 = m_heap[child+1];
+			if (m_pri[c2]>m_pri[c] || (m_pri[c2]==m_pri[c] && c2<c))
 			{
-				max_pri1 = ppri[i];
-				pri_x1 = i;
-				pri_y1 = j;
+				child++;
+				c = c2;
 			}
 		}
-		pmark += m_width;
-		ppri += m_width;
+		if (m_pri[n]>m_pri[c] || (m_pri[n]==m_pri[c] && n<c))
+			break; // item is higher
+		m_heap[k] = c;
+		m_heappos[c] = k;
+		k = child;
 	}
+	m_heap[k] = n;
+	m_heappos[n] = k;
+}
 
-	pri_x = pri_x1 + m_left; // restore offset for global
-	pri_y = pri_y1 + m_top;
+/*********************************************************************/
+void inpainting::HeapSet(int n)
+{
+	int k = m_heappos[n];
+	if (k<0)
+	{
+		k = m_nheap++;
+		m_heap[k] = n;
+	}
+	HeapUp(k);
+	HeapDown(m_heappos[n]);
+}
 
-	return max_pri1;
+/*********************************************************************/
+void inpainting::HeapRemove(int n)
+{
+	int k = m_heappos[n];
+	if (k<0)
+		return;
+	m_heappos[n] = -1;
+	m_nheap--;
+	if (k == m_nheap)
+		return; // it was last
+	int last = m_heap[m_nheap]; // move last item here
+	m_heap[k] = last;
+	m_heappos[last] = k;
+	HeapUp(k);
+	HeapDown(m_heappos[last]);
 }
 
 /*********************************************************************/
@@ -512,12 +764,12 @@ void inpainting::GetMask(void)// first time mask
 				unsigned int color = *(intmask + x) & 0xFFFFFF; // without alpha
 				if((int)color == maskcolor)// if the pixel is specified as mask
 				{
-					m_mark[y*m_width+x] = TARGET;
-					m_confid[y*m_width+x] = 0;
+					m_mark[y*m_mpitch+x] = TARGET;
+					m_confid[y*m_mpitch+x] = 0;
 				}
 				else {
-					m_mark[y*m_width+x] = SOURCE;
-					m_confid[y*m_width+x] = confid1;
+					m_mark[y*m_mpitch+x] = SOURCE;
+					m_confid[y*m_mpitch+x] = confid1;
 				}
 			}
 			intmask += intmask_pitch;
@@ -535,12 +787,12 @@ void inpainting::GetMask(void)// first time mask
 				int color = *(pmask1 + x*4 + 3) ; // alpha
 				if(color > 127)// if the pixel is specified as mask, unike other modes, use threshold
 				{
-					m_mark[y*m_width+x] = TARGET;
-					m_confid[y*m_width+x] = 0;
+					m_mark[y*m_mpitch+x] = TARGET;
+					m_confid[y*m_mpitch+x] = 0;
 				}
 				else {
-					m_mark[y*m_width+x] = SOURCE;
-					m_confid[y*m_width+x] = confid1;
+					m_mark[y*m_mpitch+x] = SOURCE;
+					m_confid[y*m_mpitch+x] = confid1;
 				}
 			}
 			pmask1 += src_pitch;
@@ -558,12 +810,12 @@ void inpainting::GetMask(void)// first time mask
 				int color = *(pmask1 + x*3) | *(pmask1 + x*3 + 1)<<8 | *(pmask1 + x*3 + 2)<<16; // bgr
 				if(color == maskcolor)// if the pixel is specified as mask
 				{
-					m_mark[y*m_width+x] = TARGET;
-					m_confid[y*m_width+x] = 0;
+					m_mark[y*m_mpitch+x] = TARGET;
+					m_confid[y*m_mpitch+x] = 0;
 				}
 				else {
-					m_mark[y*m_width+x] = SOURCE;
-					m_confid[y*m_width+x] = confid1;
+					m_mark[y*m_mpitch+x] = SOURCE;
+					m_confid[y*m_mpitch+x] = confid1;
 				}
 			}
 			pmask1 += mask_pitch;
@@ -583,12 +835,12 @@ void inpainting::GetMask(void)// first time mask
 				int color = pmaskV1[x>>1] | pmaskU1[x>>1]<<8 | pmask1[x]<<16; // yuv
 				if(color == maskcolor)// if the pixel is specified as mask
 				{
-					m_mark[y*m_width+x] = TARGET;
-					m_confid[y*m_width+x] = 0;
+					m_mark[y*m_mpitch+x] = TARGET;
+					m_confid[y*m_mpitch+x] = 0;
 				}
 				else {
-					m_mark[y*m_width+x] = SOURCE;
-					m_confid[y*m_width+x] = confid1;
+					m_mark[y*m_mpitch+x] = SOURCE;
+					m_confid[y*m_mpitch+x] = confid1;
 				}
 			}
 			pmask1 += mask_pitch;
@@ -613,22 +865,22 @@ void inpainting::GetMask(void)// first time mask
 				int color = V | U<<8 | pmask1[x<<1]<<16; // yuv
 				if(color == maskcolor)// if the pixel is specified as mask
 				{
-					m_mark[y*m_width+x] = TARGET;
-					m_confid[y*m_width+x] = 0;
+					m_mark[y*m_mpitch+x] = TARGET;
+					m_confid[y*m_mpitch+x] = 0;
 				}
 				else {
-					m_mark[y*m_width+x] = SOURCE;
-					m_confid[y*m_width+x] = confid1;
+					m_mark[y*m_mpitch+x] = SOURCE;
+					m_confid[y*m_mpitch+x] = confid1;
 				}
 				color = V | U<<8 | pmask1[(x<<1)+2]<<16; // second yuv
 				if(color == maskcolor)// if the pixel is specified as mask
 				{
-					m_mark[y*m_width+x+1] = TARGET;
-					m_confid[y*m_width+x+1] = 0;
+					m_mark[y*m_mpitch+x+1] = TARGET;
+					m_confid[y*m_mpitch+x+1] = 0;
 				}
 				else {
-					m_mark[y*m_width+x+1] = SOURCE;
-					m_confid[y*m_width+x+1] = confid1;
+					m_mark[y*m_mpitch+x+1] = SOURCE;
+					m_confid[y*m_mpitch+x+1] = confid1;
 				}
 			}
 			pmask1 += mask_pitch;
@@ -646,12 +898,12 @@ void inpainting::GetMask(void)// first time mask
 				int color = *(pmask1 + 2 + x*3) | *(pmask1 + x*3 + 1)<<8 | *(pmask1 + x*3 + 0)<<16; // vuy
 				if(color == maskcolor)// if the pixel is specified as mask
 				{
-					m_mark[y*m_width+x] = TARGET;
-					m_confid[y*m_width+x] = 0;
+					m_mark[y*m_mpitch+x] = TARGET;
+					m_confid[y*m_mpitch+x] = 0;
 				}
 				else {
-					m_mark[y*m_width+x] = SOURCE;
-					m_confid[y*m_width+x] = confid1;
+					m_mark[y*m_mpitch+x] = SOURCE;
+					m_confid[y*m_mpitch+x] = confid1;
 				}
 			}
 			pmask1 += mask_pitch;
@@ -663,18 +915,20 @@ void inpainting::GetMask(void)// first time mask
 void inpainting::DrawBoundary(void)// fist time draw boundary
 {
 
+	m_ntargets = 0;
 	for(int j= 0; j< m_height; j++)
 	    for(int i = 0; i< m_width; i++)
 		{
-			if(m_mark[j*m_width+i]==TARGET)
+			if(IS_TARGET(m_mark[j*m_mpitch+i])) // same test as fill in update
 			{
+				m_ntargets++;
 				if(i<m_left)m_left = i; // rrsize the rectangle to the range of target area
 				if(i>m_right)m_right = i;
 				if(j>m_bottom)m_bottom = j;
 				if(j<m_top)m_top = j;
-				//if one of the four neighbours is source pixel, then this should be a boundary
-				if(j==m_height-1||j==0||i==0||i==m_width-1||m_mark[(j-1)*m_width+i]==SOURCE||m_mark[j*m_width+i-1]==SOURCE
-					||m_mark[j*m_width+i+1]==SOURCE||m_mark[(j+1)*m_width+i]==SOURCE)m_mark[j*m_width+i] = BOUNDARY;
+				//if one of the four neighbours is source (or outside) pixel, then this should be a boundary
+				if(!IS_TARGET(m_mark[(j-1)*m_mpitch+i])||!IS_TARGET(m_mark[j*m_mpitch+i-1])
+					||!IS_TARGET(m_mark[j*m_mpitch+i+1])||!IS_TARGET(m_mark[(j+1)*m_mpitch+i]))m_mark[j*m_mpitch+i] = BOUNDARY;
 			}
 		}
 }
@@ -694,13 +948,78 @@ int inpainting::priority(int i, int j)
 int inpainting::ComputeConfidence(int i, int j)
 {
 	int confidence=0;
-	for(int y = MAX(j -winysize,0); y< MIN(j+winysize,m_height); y++)
-		for(int x = MAX(i-winxsize,0); x<MIN(i+winxsize, m_width); x++)
-			confidence+= m_confid[y*m_width+x];
+	if (m_usefenwick) // window inside frame (apron confidence is 0)
+	{
+		int x0 = MAX(i-winxsize, 0);
+		int x1 = MIN(i+winxsize, m_width);
+		int y0 = MAX(j-winysize, 0);
+		int y1 = MIN(j+winysize, m_height);
+		confidence = (int)(FenwickSum(x1, y1) - FenwickSum(x0, y1) - FenwickSum(x1, y0) + FenwickSum(x0, y0));
+	}
+	else
+	for(int y = j-winysize; y<j+winysize; y++) // apron confidence is 0
+		for(int x = i-winxsize; x<i+winxsize; x++)
+			confidence+= m_confid[y*m_mpitch+x];
 	confidence /= (winxsize*2)*(winysize*2);
 	return confidence;
 
 }
+
+/*********************************************************************/
+void inpainting::BuildFenwick(void)
+{
+	// tree is used if its 4 queries (by log2 of width and height steps) are faster than summation of patch.
+	// Unsigned overflow is not a problem, since window sums are small
+	int logw = 0, logh = 0;
+	while ((1<<logw) <= m_width) logw++;
+	while ((1<<logh) <= m_height) logh++;
+	m_usefenwick = ((winxsize*2)*(winysize*2) > 4*logw*logh);
+	if (!m_usefenwick)
+		return;
+
+	int fpitch = m_width+1;
+	memset(m_fenwick, 0, fpitch*sizeof(unsigned int)); // row 0 is not used
+	for(int y = 1; y<=m_height; y++)
+	{
+		unsigned int * row = m_fenwick + y*fpitch;
+		row[0] = 0;
+		for(int x = 1; x<=m_width; x++)
+			row[x] = m_confid[(y-1)*m_mpitch+x-1];
+		for(int x = 1; x<=m_width; x++) // in place build of rows, then columns
+		{
+			int p = x + (x & -x);
+			if (p<=m_width)
+				row[p] += row[x];
+		}
+	}
+	for(int y = 1; y<=m_height; y++)
+	{
+		int p = y + (y & -y);
+		if (p<=m_height)
+			for(int x = 1; x<=m_width; x++)
+				m_fenwick[p*fpitch+x] += m_fenwick[y*fpitch+x];
+	}
+}
+
+/*********************************************************************/
+void inpainting::FenwickAdd(int x, int y, int delta)
+{
+	int fpitch = m_width+1;
+	for(int fy = y+1; fy<=m_height; fy += fy & -fy)
+		for(int fx = x+1; fx<=m_width; fx += fx & -fx)
+			m_fenwick[fy*fpitch+fx] += delta;
+}
+
+/*********************************************************************/
+unsigned int inpainting::FenwickSum(int x, int y)
+{
+	int fpitch = m_width+1;
+	unsigned int sum = 0;
+	for(int fy = y; fy>0; fy -= fy & -fy)
+		for(int fx = x; fx>0; fx -= fx & -fx)
+			sum += m_fenwick[fy*fpitch+fx];
+	return sum;
+}
 /*********************************************************************/
 int inpainting::ComputeData(int i, int j)
 {
@@ -711,18 +1030,28 @@ int inpainting::ComputeData(int i, int j)
 	int magnitude;
 	int magmax=0;
 	int x, y;
-	for(y = MAX(j -winysize,0); y< MIN(j+winysize,m_height); y++)
+	if (m_usegradmap) // the same greatest gradient found by GradientMap
+	{
+		long long key = m_gradmax[j*m_width+i];
+		if(key>>32 > 0) // not zero magnitude
+		{
+			int best = 0x7FFFFFFF - (int)(key & 0x7FFFFFFF);
+			grad = GetGradient(best%m_width, best/m_width);
+		}
+	}
+	else
+	for(y = j-winysize; y<j+winysize; y++) // apron is not source
 	{
-		for( x = MAX(i-winxsize,0); x<MIN(i+winxsize, m_width); x++)
+		for( x = i-winxsize; x<i+winxsize; x++)
 		{
 			// find the greatest gradient in this patch, this will be the gradient of this pixel(according to "detail paper")
-			if(m_mark[y*m_width+x] == SOURCE) // source pixel
+			if(m_mark[y*m_mpitch+x] == SOURCE) // source pixel
 			{
 				//since I use four neighbors to calculate the gradient, make sure this four neighbors do not touch target region(big jump in gradient)
-				if( (x+1<m_width && m_mark[y*m_width+x+1]!=SOURCE) // add bound check (Fizick)
-					|| (x-1>=0 && m_mark[y*m_width+x-1]!=SOURCE)
-					|| (y+1<m_height && m_mark[(y+1)*m_width+x]!=SOURCE)
-					|| (y-1>=0 && m_mark[(y-1)*m_width+x]!=SOURCE))
+				if( IS_TARGET(m_mark[y*m_mpitch+x+1]) // outside neighbours are not target
+					|| IS_TARGET(m_mark[y*m_mpitch+x-1])
+					|| IS_TARGET(m_mark[(y+1)*m_mpitch+x])
+					|| IS_TARGET(m_mark[(y-1)*m_mpitch+x]))
 					continue;
  				temp = GetGradient(x,y);
 				magnitude = temp.grad_x*temp.grad_x+temp.grad_y*temp.grad_y;
@@ -745,6 +1074,63 @@ int inpainting::ComputeData(int i, int j)
 	return result;
 }
 
+/*********************************************************************/
+long long inpainting::GradientKey(int x, int y)
+{
+	// squared gradient magnitude in high half, reversed raster index in low half, so greatest key is greatest gradient
+	// and first pixel in raster order for equal (as by scan of patch). -1 for source pixels which touch target region
+	// (big jump in gradient), for not source and outside pixels
+	unsigned char * pmark = m_mark + y*m_mpitch + x;
+	if(*pmark != SOURCE || IS_TARGET(pmark[1]) || IS_TARGET(pmark[-1])
+		|| IS_TARGET(pmark[m_mpitch]) || IS_TARGET(pmark[-m_mpitch])) // outside neighbours are not target
+		return -1;
+	gradient g = GetGradient(x, y);
+	long long magnitude = g.grad_x*g.grad_x + g.grad_y*g.grad_y;
+	return (magnitude<<32) | (0x7FFFFFFF - (y*m_width+x));
+}
+
+/*********************************************************************/
+void inpainting::GradientMap(int left, int top, int right, int bottom)
+{
+	// greatest gradient keys in patch windows which intersect changed rectangle:
+	// in rows (patch width), then in columns of row results (patch height).
+	// Window of pixel x is x-winxsize..x+winxsize-1
+	int x0 = MAX(left-winxsize+1, 0);
+	int x1 = MIN(right+winxsize, m_width);
+	int y0 = MAX(top-winysize+1, 0);
+	int y1 = MIN(bottom+winysize, m_height);
+	if(x0>=x1 || y0>=y1)
+		return;
+	long long * line = m_slidebuf;
+	for(int y = MAX(top, 0); y<MIN(bottom, m_height); y++)
+	{
+		for(int x = x0-winxsize; x<x1+winxsize-1; x++) // outside (apron) pixels are not source
+			line[x-x0+winxsize] = GradientKey(x, y);
+		SlidingMax(line, m_gradrow + y*m_width + x0, 1, x1-x0, winxsize*2);
+	}
+	for(int x = x0; x<x1; x++)
+	{
+		for(int y = y0-winysize; y<y1+winysize-1; y++)
+			line[y-y0+winysize] = (y<0 || y>=m_height) ? -1 : m_gradrow[y*m_width+x];
+		SlidingMax(line, m_gradmax + y0*m_width + x, m_width, y1-y0, winysize*2);
+	}
+}
+
+/*********************************************************************/
+void inpainting::SlidingMax(const long long * in, long long * out, int outstride, int n, int len)
+{
+	// out[k] = max of in[k..k+len-1] for n outputs, by van Herk/Gil-Werman algorithm:
+	// prefix and suffix maxima in blocks of window size, window is suffix of one block and prefix of next
+	int m = n+len-1;
+	long long * g = m_slidebuf + m; // prefix maxima in block (after input line)
+	long long * h = g + m; // suffix maxima in block
+	for(int p = 0; p<m; p++)
+		g[p] = (p%len == 0) ? in[p] : MAX(in[p], g[p-1]);
+	for(int p = m-1; p>=0; p--)
+		h[p] = (p%len == len-1 || p == m-1) ? in[p] : MAX(in[p], h[p+1]);
+	for(int k = 0; k<n; k++)
+		out[k*outstride] = MAX(h[k], g[k+len-1]);
+}
 
 /*********************************************************************/
 
@@ -793,13 +1179,13 @@ norm inpainting::GetNorm(int i, int j)
 	int neighbor_y[9];
 	int record[9];
 	int count = 0;
-	for(int y = MAX(j-1,0); y<MIN(j+1,m_height); y++)
+	for(int y = j-1; y<j+1; y++) // apron is not boundary
 	{
-		for(int x = MAX(i-1,0); x<MIN(i+1,m_width); x++)
+		for(int x = i-1; x<i+1; x++)
 		{
 			count++;
 			if(x==i&&y==j)continue;
-			if(m_mark[y*m_width+x]==BOUNDARY)
+			if(m_mark[y*m_mpitch+x]==BOUNDARY)
 			{
 				num++;
 				neighbor_x[num] = x;
@@ -837,672 +1223,1656 @@ bool inpainting::draw_source(void)
 		for(int i = 0; i<m_width; i++)
 		{
 			flag=true;
-			if(i<winxsize||j<winysize||i>m_width-winxsize||j>m_height-winysize)
-				m_source[j*m_width+i]=0;//cannot form a complete window
-			else
+			for(int y = j-winysize; y<j+winysize; y++) // window which is not complete in frame has outside pixels
 			{
-				for(int y = j-winysize; y<j+winysize; y++)
+				for(int x = i-winxsize; x<i+winxsize; x++)
 				{
-					for(int x = i-winxsize; x<i+winxsize; x++)
+					if(m_mark[y*m_mpitch+x]!=SOURCE)
 					{
-						if(m_mark[y*m_width+x]!=SOURCE)
-						{
-							m_source[j*m_width+i]=0;
-							flag = false;
-							break;
-						}
+						m_source[j*m_width+i]=0;
+						flag = false;
+						break;
 					}
-					if(flag==false)break;
 				}
-			    if(flag!=false)m_source[j*m_width+i]=1;
+				if(flag==false)break;
 			}
+		    if(flag!=false)m_source[j*m_width+i]=1;
+		}
+	}
+
+	if (psrcarea) // centres of source patches at bright pixels of source area clip only
+	{
+		// threshold of luma (or green for RGB)
+		int bpp = (pixel_format == RGB32 || pixel_format == RGBA) ? 4 : (pixel_format == RGB24 || pixel_format == YUV24) ? 3 : (pixel_format == YUY2) ? 2 : 1;
+		int offset = (pixel_format == RGB32 || pixel_format == RGBA || pixel_format == RGB24) ? 1 : 0;
+		for(int j = 0; j<m_height; j++)
+		{
+			const unsigned char * parea = psrcarea + j*srcarea_pitch + offset;
+			for(int i = 0; i<m_width; i++)
+				if(parea[i*bpp] <= 127)
+					m_source[j*m_width+i]=0;
 		}
 	}
+
+	// the same as runs of valid centres in every row, for search loops
+	// and their bounding box
+	int nruns = 0;
+	m_sleft = m_width;
+	m_sright = 0;
+	m_stop = m_height;
+	m_sbottom = 0;
+	for(int j = 0; j<m_height; j++)
+	{
+		m_rowruns[j] = nruns;
+		for(int i = 0; i<m_width; i++)
+		{
+			if(m_source[j*m_width+i]==0)
+				continue;
+			m_runs[nruns*2] = i;
+			for(; i<m_width && m_source[j*m_width+i]; i++);
+			m_runs[nruns*2+1] = i;
+			nruns++;
+		}
+		if (nruns > m_rowruns[j])
+		{
+			m_sleft = MIN(m_sleft, m_runs[m_rowruns[j]*2]);
+			m_sright = MAX(m_sright, m_runs[nruns*2-1]);
+			m_stop = MIN(m_stop, j);
+			m_sbottom = j+1;
+		}
+	}
+	m_rowruns[m_height] = nruns;
 	return true;
 }
 
 /*********************************************************************/
-bool inpainting::PatchTexture(int x, int y, int &patch_x, int &patch_y)
+int inpainting::FirstRun(int j, int x)
 {
-	// find the most similar patch, according to SSD
-
-#define MIN_INITIAL 99999999
-
-    int ymin, ymax, xmin, xmax;
-
-	if (radius>0) // added by Fizick
-    {
-        ymin = MAX(y-radius, 0);
-        ymax = MIN(y+radius, m_height);
-        xmin = MAX(x-radius, 0);
-        xmax = MIN(x+radius, m_width);
-    }
-    else // full frame search (slow)
-    {
-        ymin = 0;
-        ymax = m_height;
-        xmin = 0;
-        xmax = m_width;
-    }
-
-
-	unsigned char *psrc1 = psrc;
-	int winxsize1 = winxsize;
-
-	long min=MIN_INITIAL;
-	long sum;
-	int source_x, source_y;
-	int target_x, target_y;
-
-	if(pixel_format == RGB32 || pixel_format == RGBA)
+	// first run of valid source centres in row j which ends after x (binary search)
+	int lo = m_rowruns[j];
+	int hi = m_rowruns[j+1];
+	while(lo<hi)
 	{
+		int mid = (lo+hi)/2;
+		if(m_runs[mid*2+1] <= x)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
 
-		for(int j = ymin; j<ymax; j++)
+/*********************************************************************/
+void inpainting::SortRows(int x, int y)
+{
+	// make the order of patch rows for PatchSAD: rows with more known pixels first (to exceed min early),
+	// rows without known pixels are skipped at all
+	m_nrows = 0;
+	for(int iter_y=-winysize; iter_y<winysize; iter_y++)
+	{
+		unsigned char * tymark = m_mark + (y+iter_y)*m_mpitch;
+		int known = 0;
+		for(int target_x = x-winxsize; target_x<x+winxsize; target_x++)
+			known += (tymark[target_x]==SOURCE); // outside pixels are not known
+		if (known == 0)
+			continue;
+		int r = m_nrows++;
+		while (r>0 && m_rowknown[r-1]<known) // insertion sort, stable
 		{
-			for(int i = xmin; i<xmax; i++)
-			{
-				if(m_source[j*m_width+i]==0)continue; // not good patch source
-				sum=0;
-
-				for(int iter_y=MAX(-winysize, -y); iter_y<MIN(winysize, m_height-y); iter_y++)
-				{
-					source_y = j+iter_y;
-					target_y = y+iter_y;
-
-					unsigned char * tysrc = psrc + target_y*src_pitch;
-					unsigned char * sysrc = psrc + source_y*src_pitch;
-					unsigned char * tymark = m_mark + target_y*m_width;
-
-					if (x-winxsize<0 || x+winxsize>m_width) // process border separately to process middle without checking (faster)
-					{
-
-						for(int iter_x=(-1)*winxsize; iter_x<winxsize; iter_x++)
-						{
-							source_x = i+iter_x;
-							target_x = x+iter_x;
-							if(target_x<0||target_x>=m_width)continue;
-
-							// it is the most time-comsuming part of code:
-							if(tymark[target_x]==SOURCE) // compare
-							{
-								int temp_b = tysrc[target_x*4]-sysrc[source_x*4];
-								int temp_g = tysrc[target_x*4+1]-sysrc[source_x*4+1];
-								int temp_r = tysrc[target_x*4+2]-sysrc[source_x*4+2];
-
-//								sum += temp_r*temp_r + temp_g*temp_g + temp_b*temp_b; // SSD
-								sum += (abs(temp_r) + abs(temp_g) + abs(temp_b)) ; // SAD
-							}
-						}
-					}
-					else // middle
-					{
-#if (!ISSE)
-						for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
-						{
-							source_x = i+iter_x;
-							target_x = x+iter_x;
-							// it is the most time-comsuming part of code:
-							int smark = -(int)(tymark[target_x]==SOURCE); // compare, remove jump for speed
-							{
-								int temp_b = (int)tysrc[target_x*4]-sysrc[source_x*4];
-								int temp_g = (int)tysrc[target_x*4+1]-sysrc[source_x*4+1];
-								int temp_r = (int)tysrc[target_x*4+2]-sysrc[source_x*4+2];
-
-//								sum += (temp_r*temp_r + temp_g*temp_g + temp_b*temp_b) & smark; // SSD
-								sum += (abs(temp_r) + abs(temp_g) + abs(temp_b)) & smark; // SAD
-							}
-						}
-#else
-						_asm
-						{
-							//push rsi;
-							//push rdi;
-							//push rbx;
-							// assume winxsize is multiple 2
-							mov rsi, sysrc;
-							mov rdi, tysrc;
-							mov eax, i;
-							mov ecx, winxsize1;
-							sub rax, rcx; // source_x = i + iter_x (start iter_x = -winxsize)
-							mov edx, x;
-							sub rdx, rcx; // target_x = x + iter_x
-							mov rbx, tymark;
-							pxor mm0, mm0; // constant 0
-							pcmpeqd mm1, mm1; // constant two FFFFFFFF
-							pxor mm2, mm2; // 0, will be our block sum as low word
-							psrld mm1, 8; // constant two 00FFFFFF with 00 at alpha
-align 16
-startRGBA:
-							movd mm3, [rbx + rdx]; // read 4 pixel mark, but will use 2 only
-							punpcklbw mm3, mm0; // bytes to 4 words
-							punpcklwd mm3, mm0; // words to 2 doublewords
-							movq mm4, [rsi + rax*4]; // read 2 source pixels by 4 bytes BGRA
-							pcmpeqd mm3, mm0;// compare every doubleword mark with 0
-							movq mm5, [rdi + rdx*4]; // read 2 target pixels by 4 bytes BGRA
-							pand mm3, mm1; // final mask of mark and alpha
-							pand mm4, mm3;// clear masked bytes
-							pand mm5, mm3;// clear masked bytes
-							psadbw mm4, mm5; // get  summ of absolute differenses SAD of 2 masked RGB pixels
-							paddw mm2, mm4; // add to block sum
-							add rdx, 2; // nex mark
-							add rax, 2; // next 2 pixels
-							dec rcx;
-							jrcxz endRGBA;
-							jmp startRGBA;
-endRGBA:
-							movd mm6, sum;// get old sum of block
-							punpcklwd mm2, mm0; // words with partial sum to doublewords, use low
-							paddd mm6, mm2; // add to block sum
-							movd sum, mm6; // update sum of block
-							//pop rbx;
-							//pop rdi;
-							//pop rsi;
-						}
-#endif
-					}
-				}
-				if(sum<min)
-				{
-					min=sum;
-					patch_x = i;
-					patch_y = j;
-				}
-			}
+			m_rows[r] = m_rows[r-1];
+			m_rowknown[r] = m_rowknown[r-1];
+			r--;
 		}
+		m_rows[r] = iter_y;
+		m_rowknown[r] = known;
 	}
-	else if(pixel_format == RGB24 || pixel_format == YUV24 )
+}
+
+/*********************************************************************/
+void inpainting::CacheTarget(int x, int y)
+{
+	// copy rows of target patch (in order of SortRows) to cache with masks of known bytes,
+	// unknown and outside pixels are zero, so PatchSAD compares whole rows without checks.
+	// Candidate source patch is always inside frame. Only for interleaved RGB formats (and YUV24) and YV12.
+	if(m_planes) // interleaved formats, by rows of 3 planes
 	{
-		for(int j = ymin; j<ymax; j++)
+		int n = winxsize*2;
+		m_tcache_pitch = n*3;
+		for(int r=0; r<m_nrows; r++)
 		{
-			for(int i = xmin; i<xmax; i++)
-			{
-				if(m_source[j*m_width+i]==0)continue; // not good patch source
-				sum=0;
-				for(int iter_y=MAX(-winysize, -y); iter_y<MIN(winysize, m_height-y); iter_y++)
-				{
-					source_y = j+iter_y;
-					target_y = y+iter_y;
-
-					unsigned char * tysrc = psrc + target_y*src_pitch;
-					unsigned char * sysrc = psrc + source_y*src_pitch;
-					unsigned char * tymark = m_mark + target_y*m_width;
-
-					if (x-winxsize<0 || x+winxsize>m_width) // process border separately to process middle without checking (faster)
-					{
-
-						for(int iter_x=(-1)*winxsize; iter_x<winxsize; iter_x++)
-						{
-							source_x = i+iter_x;
-							target_x = x+iter_x;
-							if(target_x<0||target_x>=m_width)continue;
-
-							// it is the most time-comsuming part of code:
-							if(tymark[target_x]==SOURCE) // compare
-							{
-								int temp_b = tysrc[target_x*3]-sysrc[source_x*3];
-								int temp_g = tysrc[target_x*3+1]-sysrc[source_x*3+1];
-								int temp_r = tysrc[target_x*3+2]-sysrc[source_x*3+2];
-
-//								sum += temp_r*temp_r + temp_g*temp_g + temp_b*temp_b; // SSD
-								sum += (abs(temp_r) + abs(temp_g) + abs(temp_b)) ; // SAD
-							}
-						}
-					}
-					else // middle
-					{
-#if (!ISSE)
-						for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
-						{
-							source_x = i+iter_x;
-							target_x = x+iter_x;
-							// it is the most time-comsuming part of code:
-							int smark = -(int)(tymark[target_x]==SOURCE); // compare, remove jump for speed
-							{
-								int temp_b = (int)tysrc[target_x*3]-sysrc[source_x*3];
-								int temp_g = (int)tysrc[target_x*3+1]-sysrc[source_x*3+1];
-								int temp_r = (int)tysrc[target_x*3+2]-sysrc[source_x*3+2];
-
-//								sum += (temp_r*temp_r + temp_g*temp_g + temp_b*temp_b) & smark; // SSD
-								sum += (abs(temp_r) + abs(temp_g) + abs(temp_b)) & smark; // SAD
-							}
-						}
-#else
-						_asm
-						{
-							//push rsi;
-							//push rdi;
-							//push rbx;
-							// assume winxsize is multiple 2
-							mov rsi, sysrc;
-							mov rdi, tysrc;
-							mov eax, i;
-							mov ecx, winxsize1;
-							sub rax, rcx; // source_x = i + iter_x (start iter_x = -winxsize)
-							mov edx, x;
-							sub rdx, rcx; // target_x = x + iter_x
-							mov rbx, tymark;
-							pxor mm0, mm0; // constant 0
-							pcmpeqd mm1, mm1; // constant FFFFFFFF FFFFFFFF
-							pxor mm2, mm2; // 0, will be our block sum as low word
-							psrlq mm1, 16; // constant two 0000FFFF FFFFFFFF with ..rgbrgb
-							//push rbp; // save rbp
-							mov rbp, rax;
-							add rbp, rax;
-							add rax, rbp; // rax = rax*3
-							mov rbp, rdx;
-							add rbp, rdx;
-							add rbp, rdx; // rbp = rdx*3
-
-align 16
-startRGB24:
-							movd mm3, [rbx + rdx]; // read 4 pixel mark, but will use 2 only
-							punpcklbw mm3, mm0; // bytes to 4 words
-							punpcklwd mm3, mm0; // low words to 2 doublewords
-							pcmpeqd mm3, mm0;// compare every doubleword mark with 0
-							psrlq mm3, 8; // shift mask to .2222111
-							movq mm4, [rsi + rax]; // read 2 source pixels by 3 bytes BGR and some extra 2 bytes
-							movq mm5, [rdi + rbp]; // read 2 target pixels by 3 bytes BGR and some extra 2 bytes
-							pand mm3, mm1; // final mask of mark and pix
-							pand mm4, mm3;// clear masked bytes
-							pand mm5, mm3;// clear masked bytes
-							psadbw mm4, mm5; // get  summ of absolute differenses SAD of 2 masked RGB pixels
-							paddw mm2, mm4; // add to block sum
-							add rdx, 2; // nex mark
-							add rax, 6; // next 2 pixels
-							add rbp, 6
-							dec rcx;
-							jrcxz endRGB24;
-							jmp startRGB24;
-endRGB24:
-							//pop rbp; // restore rbp for sum parameter
-							movd mm6, sum;// get old sum of block
-							punpcklwd mm2, mm0; // words with partial sum to doublewords, use low
-							paddd mm6, mm2; // add to block sum
-							movd sum, mm6; // update sum of block
-							//pop rbx;
-							//pop rdi;
-							//pop rsi;
-						}
-#endif
-					}
-				}
-				if(sum<min)
+			int target_y = y+m_rows[r];
+			unsigned char * typlane = m_planes + target_y*3*m_ppitch + x-winxsize;
+			unsigned char * tymark = m_mark + target_y*m_mpitch + x-winxsize;
+			unsigned char * tc = m_tcache + r*m_tcache_pitch;
+			unsigned char * mc = m_mcache + r*m_tcache_pitch;
+			for(int c=0; c<3; c++, typlane += m_ppitch, tc += n, mc += n)
+				for(int k=0; k<n; k++)
 				{
-					min=sum;
-					patch_x = i;
-					patch_y = j;
+					bool known = (tymark[k]==SOURCE); // outside pixels of plane row are not read
+					tc[k] = known ? typlane[k] : 0;
+					mc[k] = known ? 0xFF : 0;
 				}
-			}
 		}
 	}
-
 	else if(pixel_format == YV12)
 	{
-		// may it should be implemented differently, with lesser weight of chroma (like MVTools)
-		for(int j = ymin; j<ymax; j++)
+		// luma rows, then rows of chroma samples (U and V) at chroma resolution.
+		// Only samples with all 4 luma pixels inside patch are used, so samples of source patch
+		// are never changed by inpainting. Sample with 4 known luma pixels is compared by kernel,
+		// partially known ones are listed and weighted by number of their known luma pixels.
+		m_tcache_pitch = winxsize*2;
+		for(int r=0; r<m_nrows; r++)
 		{
-			for(int i = xmin; i<xmax; i++)
+			int target_y = y+m_rows[r];
+			unsigned char * tysrc = psrc + target_y*src_pitch;
+			unsigned char * tymark = m_mark + target_y*m_mpitch;
+			unsigned char * tc = m_tcache + r*m_tcache_pitch;
+			unsigned char * mc = m_mcache + r*m_tcache_pitch;
+			for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
 			{
-				if(m_source[j*m_width+i]==0)continue; // not good patch source
-				sum=0;
-				for(int iter_y=MAX(-winysize, -y); iter_y<MIN(winysize, m_height-y); iter_y++)
-				{
-					source_y = j+iter_y;
-					target_y = y+iter_y;
-
-					unsigned char * tysrc = psrc + target_y*src_pitch;
-					unsigned char * sysrc = psrc + source_y*src_pitch;
-					unsigned char * tymark = m_mark + target_y*m_width;
-					unsigned char * tysrcU = psrcU + (target_y>>1)*src_pitchUV;
-					unsigned char * sysrcU = psrcU + (source_y>>1)*src_pitchUV;
-					unsigned char * tysrcV = psrcV + (target_y>>1)*src_pitchUV;
-					unsigned char * sysrcV = psrcV + (source_y>>1)*src_pitchUV;
-
-					if (x-winxsize<0 || x+winxsize>m_width) // process border separately to process middle without checking (faster)
-					{
-
-						for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
-						{
-							source_x = i+iter_x;
-							target_x = x+iter_x;
-							if(target_x<0||target_x>=m_width)continue;
-
-							// it is the most time-comsuming part of code:
-							if(tymark[target_x]==SOURCE) // compare
-							{
-							int temp_y = tysrc[target_x]-sysrc[source_x];
-							int temp_u = tysrcU[(target_x>>1)]-sysrcU[(source_x>>1)];
-							int temp_v = tysrcV[(target_x>>1)]-sysrcV[(source_x>>1)];
-
-//							sum += temp_y*temp_y + temp_u*temp_u + temp_v*temp_v; // SSD
-							sum += abs(temp_y) + abs(temp_u) + abs(temp_v); // SAD
-							}
-						}
-					}
-					else // middle
-					{
-#if (!ISSE)
-						for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
-						{
-							source_x = i+iter_x;
-							target_x = x+iter_x;
-							// it is the most time-comsuming part of code:
-							int smark = -(int)(tymark[target_x]==SOURCE); // compare, remove jump for speed
-							int temp_y = tysrc[target_x]-sysrc[source_x];
-							int temp_u = tysrcU[(target_x>>1)]-sysrcU[(source_x>>1)];
-							int temp_v = tysrcV[(target_x>>1)]-sysrcV[(source_x>>1)];
-
-//							sum += temp_y*temp_y + temp_u*temp_u + temp_v*temp_v; // SSD
-							sum += (abs(temp_y) + abs(temp_u) + abs(temp_v)) & smark; // SAD
-						}
-#else
-						_asm
-						{
-							//push rsi;
-							//push rdi;
-							//push rbx;
-							// assume winxsize is multiple 4
-							mov rsi, sysrc;
-							mov rdi, tysrc;
-							mov eax, i;
-							mov ecx, winxsize1;
-							sub rax, rcx; // source_x = i + iter_x (start iter_x = -winxsize)
-							mov edx, x;
-							sub rdx, rcx; // target_x = x + iter_x
-							shr rcx, 1; // count by 4 pixels
-							mov rbx, tymark;
-							pxor mm0, mm0; // constant 0
-							pcmpeqd mm1, mm1; // constant two FFFFFFFF
-							pxor mm2, mm2; // 0, will be our block sum as low word
-							psrlq mm1, 32; // constant 00000000 FFFFFFFF hi dw only
-align 16
-startY:
-							movd mm3, [rbx + rdx]; // read 4 pixel mark
-							pcmpeqb mm3, mm0;// compare every byte mark with 0
-							movd mm4, [rsi + rax]; // read 4 source pixels
-							movd mm5, [rdi + rdx]; // read 4 target pixels
-							pand mm3, mm1; // clear high
-							pand mm4, mm3;// clear masked bytes
-							pand mm5, mm3;// clear masked bytes
-							psadbw mm4, mm5; // get  summ of absolute differenses SAD of 4 masked Y pixels
-							paddw mm2, mm4; // add to block sum
-							add rdx, 4; // next mark
-							add rax, 4; // next 4 pixels
-							dec rcx;
-							jrcxz endY;
-							jmp startY;
-endY:
-							mov rsi, sysrcU;
-							mov rdi, tysrcU;
-							mov eax, i;
-							mov ecx, winxsize1;
-							sub eax, ecx; // source_x = i + iter_x (start iter_x = -winxsize)
-							sar eax, 1; //   /2
-							mov edx, x;
-							sub edx, ecx; // target_x = x + iter_x
-							sar edx, 1; //    /2
-							shr ecx, 1; // count by 4 pixels
-							mov rbx, tymark;
-							pxor mm0, mm0; // constant 0
-							pcmpeqd mm1, mm1; // constant two FFFFFFFF
-//							pxor mm2, mm2; // 0, will be our block sum as low word
-							psrlq mm1, 32; // constant 00000000 FFFFFFFF
-align 16
-startU:
-							movd mm3, [rbx + rdx*2]; // read 4 pixel mark
-							pcmpeqb mm3, mm0;// compare every byte mark with 0
-							movd mm4, [rsi + rax]; // read 4 source pixels, but use 2 only
-							punpcklbw mm4, mm4; // 2 bytes to 2 words with duplicate bytes
-							movd mm5, [rdi + rdx]; // read 4 target pixels, but use 2 only
-							punpcklbw mm5, mm5; // 2 bytes to 2 words
-							pand mm3, mm1; // clear high
-							pand mm4, mm3;// clear masked bytes
-							pand mm5, mm3;// clear masked bytes
-							psadbw mm4, mm5; // get  summ of absolute differenses SAD of 2 masked U pixels
-//							psrlw mm4, 1; // divide by 2 ? or 4 ?
-							paddw mm2, mm4; // add to block sum
-							add rdx, 2; // next mark
-							add rax, 2; // next 2 pixels
-							dec rcx;
-							jrcxz endU;
-							jmp startU;
-endU:
-							mov rsi, sysrcV;
-							mov rdi, tysrcV;
-							mov eax, i;
-							mov ecx, winxsize1;
-							sub rax, rcx; // source_x = i + iter_x (start iter_x = -winxsize)
-							sar rax, 1; //   /2
-							mov edx, x;
-							sub rdx, rcx; // target_x = x + iter_x
-							sar rdx, 1; //    /2
-							shr rcx, 1; // count by 4 pixels
-							mov rbx, tymark;
-							pxor mm0, mm0; // constant 0
-							pcmpeqd mm1, mm1; // constant two FFFFFFFF
-//							pxor mm2, mm2; // 0, will be our block sum as low word
-							psrlq mm1, 32; // constant 00000000 FFFFFFFF
-align 16
-startV:
-							movd mm3, [rbx + rdx*2]; // read 4 pixel mark
-							pcmpeqb mm3, mm0;// compare every byte mark with 0
-							movd mm4, [rsi + rax]; // read 4 source pixels, but use 2 only
-							punpcklbw mm4, mm4; // 2 bytes to 2 words with duplicate bytes
-							movd mm5, [rdi + rdx]; // read 4 target pixels, but use 2 only
-							punpcklbw mm5, mm5; // 2 bytes to 2 words
-							pand mm3, mm1; // clear high
-							pand mm4, mm3;// clear masked bytes
-							pand mm5, mm3;// clear masked bytes
-							psadbw mm4, mm5; // get  summ of absolute differenses SAD of 2 masked U pixels
-//							psrlw mm4, 1; // divide by 2 ? or 4 ?
-							paddw mm2, mm4; // add to block sum
-							add rdx, 2; // next mark
-							add rax, 2; // next 2 pixels
-							dec rcx;
-							jrcxz endV;
-							jmp startV;
-endV:
-							movd mm6, sum;// get old sum of block
-							punpcklwd mm2, mm0; // words with partial sum to doublewords, use low
-							paddd mm6, mm2; // add to block sum
-							movd sum, mm6; // update sum of block
-							//pop rbx;
-							//pop rdi;
-							//pop rsi;
-						}
-#endif
-					}
-				}
-				if(sum<min)
-				{
-					min=sum;
-					patch_x = i;
-					patch_y = j;
-				}
+				int target_x = x+iter_x;
+				bool known = (tymark[target_x]==SOURCE);
+				*tc++ = known ? tysrc[target_x] : 0;
+				*mc++ = known ? 0xFF : 0;
 			}
 		}
-	}
-	else if(pixel_format == YUY2)
-	{
-
-		for(int j = ymin; j<ymax; j++)
+		int cx0 = (x-winxsize+1)>>1; // first sample inside patch
+		int cy0 = (y-winysize+1)>>1;
+		int cw = ((x+winxsize)>>1) - cx0;
+		int ch = ((y+winysize)>>1) - cy0;
+		m_tcache_pitchUV = cw;
+		m_ncrows = 0;
+		m_ncsamples = 0;
+		unsigned char * tc = m_tcache + winysize*2*m_tcache_pitch;
+		unsigned char * mc = m_mcache + winysize*2*m_tcache_pitch;
+		for(int r=0; r<ch; r++)
 		{
-			for(int i = xmin; i<xmax; i++)
+			int cy = cy0+r;
+			unsigned char * tymark = m_mark + cy*2*m_mpitch;
+			int known = 0;
+			for(int k=0; k<cw; k++)
 			{
-				if(m_source[j*m_width+i]==0)continue; // not good patch source
-				sum=0;
-
-				for(int iter_y=MAX(-winysize, -y); iter_y<MIN(winysize, m_height-y); iter_y++)
+				int cx = cx0+k; // luma pixels of outside chroma are outside
+				int n = (tymark[cx*2]==SOURCE) + (tymark[cx*2+1]==SOURCE) +
+					(tymark[m_mpitch+cx*2]==SOURCE) + (tymark[m_mpitch+cx*2+1]==SOURCE);
+				tc[k] = (n==4) ? psrcU[cy*src_pitchUV+cx] : 0;
+				tc[cw+k] = (n==4) ? psrcV[cy*src_pitchUV+cx] : 0;
+				mc[k] = mc[cw+k] = (n==4) ? 0xFF : 0;
+				if(n>0 && n<4)
 				{
-					source_y = j+iter_y;
-					target_y = y+iter_y;
-
-					unsigned char * tysrc = psrc + target_y*src_pitch;
-					unsigned char * sysrc = psrc + source_y*src_pitch;
-					unsigned char * tymark = m_mark + target_y*m_width;
-
-					if (x-winxsize<0 || x+winxsize>m_width) // process border separately to process middle without checking (faster)
-					{
-
-						for(int iter_x=(-1)*winxsize; iter_x<winxsize; iter_x++)
-						{
-							source_x = i+iter_x;
-							target_x = x+iter_x;
-							if(target_x<0||target_x>=m_width)continue;
-
-							// it is the most time-comsuming part of code:
-							if(tymark[target_x]==SOURCE) // compare
-							{
-								int tx4 = (target_x>>1)<<2; // mult 4
-								int tU = *(tysrc + tx4 + 1);
-								int tV = *(tysrc + tx4 + 3);
-								int tY = *(tysrc + (target_x<<1));
-								int sx4 = (source_x>>1)<<2; // mult 4
-								int sY = *(sysrc + (source_x<<1));
-								int sU = *(sysrc + sx4 + 1);
-								int sV = *(sysrc + sx4 + 3);
-								int temp_y = tY - sY;
-								int temp_u = tU - sU;
-								int temp_v = tV - sV;
-
-//								sum += temp_r*temp_r + temp_g*temp_g + temp_b*temp_b; // SSD
-								sum += (abs(temp_y) + abs(temp_u) + abs(temp_v)) ; // SAD
-							}
-						}
-					}
-					else // middle
-					{
-#if (1)
-						for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
-						{
-							source_x = i+iter_x;
-							target_x = x+iter_x;
-							// it is the most time-comsuming part of code:
-							int smark = -(int)(tymark[target_x]==SOURCE); // compare, remove jump for speed
-							{
-								int tx4 = (target_x>>1)<<2; // mult 4
-								int tU = *(tysrc + tx4 + 1);
-								int tV = *(tysrc + tx4 + 3);
-								int tY = *(tysrc + (target_x<<1));
-								int sx4 = (source_x>>1)<<2; // mult 4
-								int sY = *(sysrc + (source_x<<1));
-								int sU = *(sysrc + sx4 + 1);
-								int sV = *(sysrc + sx4 + 3);
-								int temp_y = tY - sY;
-								int temp_u = tU - sU;
-								int temp_v = tV - sV;
-
-//								sum += (temp_r*temp_r + temp_g*temp_g + temp_b*temp_b) & smark; // SSD
-								sum += (abs(temp_y) + abs(temp_u) + abs(temp_v)) & smark; // SAD
-							}
-						}
-#else
-						_asm
-						{
-							// not finished!, use YUV24 instead
-							push rsi;
-							push rdi;
-							push rbx;
-							// assume winxsize is multiple 2
-							mov rsi, sysrc;
-							mov rdi, tysrc;
-							mov rax, i;
-							mov rcx, winxsize1;
-							sub rax, rcx; // source_x = i + iter_x (start iter_x = -winxsize)
-							mov rdx, x;
-							sub rdx, rcx; // target_x = x + iter_x
-							mov rbx, tymark;
-							pxor mm0, mm0; // constant 0
-							pcmpeqw mm1, mm1; // constant two FFFFFFFF
-							pxor mm2, mm2; // 0, will be our block sum as low word
-							psrlw mm1, 8; // constant two 00FF00FF, i.e. Y mask
-							push rbp;
-align 16
-startYUY2:
-							movd mm3, [rbx + rdx]; // read 4 pixel mark, but will use 2 only
-							punpcklbw mm3, mm0; // bytes to 4 words
-//							punpcklwd mm3, mm0; // words to 2 doublewords
-							pcmpeqd mm3, mm0;// compare every word mark with 0
-							mov rbp, rax;
-							shr rbp, 1; //    /2
-							movd mm4, [rsi + rbp*4]; // read 2 source pixels by 2 bytes for Chroma, mult 4
-							movd mm6, [rsi + rax*2]; // read 2 source pixels by 2 bytes for Luma
-
-							mov rbp, rdx;
-							shr rbp, 1; //    /2
-							movq mm5, [rdi + rbp*4]; // read 4 target pixels by 2 bytes for chroma
-							pand mm3, mm1; // final mask of mark
-							pand mm4, mm3;// clear masked bytes
-							pand mm5, mm3;// clear masked bytes
-							psadbw mm4, mm5; // get  summ of absolute differenses SAD of 2 masked  pixels
-							paddw mm2, mm4; // add to block sum
-							add rdx, 2; // nex mark
-							add rax, 2; // next 2 pixels
-							dec rcx;
-							jrcxz endYUY2;
-							jmp startYUY2;
-endYUY2:
-							pop rbp;
-							movd mm6, sum;// get old sum of block
-							punpcklwd mm2, mm0; // words with partial sum to doublewords, use low
-							paddd mm6, mm2; // add to block sum
-							movd sum, mm6; // update sum of block
-							pop rbx;
-							pop rdi;
-							pop rsi;
-						}
-#endif
-					}
-				}
-				if(sum<min)
-				{
-					min=sum;
-					patch_x = i;
-					patch_y = j;
+					csample * cs = m_csamples + m_ncsamples++;
+					cs->r = m_ncrows;
+					cs->k = k;
+					cs->w = n;
+					cs->u = psrcU[cy*src_pitchUV+cx];
+					cs->v = psrcV[cy*src_pitchUV+cx];
 				}
+				known += n;
 			}
+			if(known == 0)
+				continue; // row is not used
+			m_crows[m_ncrows++] = r;
+			tc += cw*2;
+			mc += cw*2;
 		}
 	}
-
-
-#if (ISSE)
-	_asm emms;
-#endif
-
-	if (min == MIN_INITIAL)
-		return false; // patch not found
 	else
-		return true; // found
+		m_tcache_pitch = 0;
+	m_blockx = -1; // blocks of previous target are not valid
 }
 
 /*********************************************************************/
-bool inpainting::update(int target_x, int target_y, int source_x, int source_y, int confid)
+long inpainting::PatchSAD(int x, int y, int i, int j, long bound)
 {
-	// apply patch
-
-	if(pixel_format==RGB32 || pixel_format == RGBA)
-	{
+	// masked SAD of target patch at (x,y) and source patch at (i,j) by rows from SortRows.
+	// Summation is stopped as soon as sum exceeds bound (partial distance), so result is exact only if <= bound
 
-		unsigned int * intsrc = reinterpret_cast<unsigned int *>(psrc); // faster access
-		int intsrc_pitch = src_pitch/4; // in int
+	long sum=0;
+	int source_x, source_y;
+	int target_x, target_y;
 
-		int x0,y0,x1,y1;
-		for(int iter_y=MAX(-winysize, -target_y); iter_y<MIN(winysize, m_height-target_y); iter_y++)// add bound check - Fizick
+	if(pixel_format == YV12) // chroma and luma rows are cached by CacheTarget
+	{
+		// chroma is compared once per chroma sample, weighted as its known luma pixels.
+		// It is compared first, since its rows are shorter and sum grows faster for early abort.
+		// Samples inside source patch are matched by index, if its first pixel has other parity than target one,
+		// the last sample (row) of target or source is not compared
+		int cw = m_tcache_pitchUV;
+		int cx0 = (i-winxsize+1)>>1;
+		int cy0 = (j-winysize+1)>>1;
+		int n = MIN(cw, ((i+winxsize)>>1) - cx0);
+		int ch = ((j+winysize)>>1) - cy0;
+		unsigned char * tc = m_tcache + winysize*2*m_tcache_pitch;
+		unsigned char * mc = m_mcache + winysize*2*m_tcache_pitch;
+		for(int r=0; r<m_ncrows && m_crows[r]<ch && sum<=bound; r++, tc += cw*2, mc += cw*2)
 		{
-				y0 = source_y+iter_y;
+			source_y = cy0 + m_crows[r];
+			sum += 4*sad.bytes(tc, psrcU + source_y*src_pitchUV + cx0, mc, n);
+			sum += 4*sad.bytes(tc + cw, psrcV + source_y*src_pitchUV + cx0, mc + cw, n);
+		}
+		for(int s=0; s<m_ncsamples && sum<=bound; s++)
+		{
+			const csample * cs = m_csamples + s;
+			if(cs->k>=n || m_crows[cs->r]>=ch)
+				continue;
+			int offset = (cy0 + m_crows[cs->r])*src_pitchUV + cx0 + cs->k;
+			sum += cs->w*(abs(cs->u - psrcU[offset]) + abs(cs->v - psrcV[offset]));
+		}
+		for(int r=0; r<m_nrows && sum<=bound; r++)
+		{
+			unsigned char * sysrc = psrc + (j+m_rows[r])*src_pitch + i-winxsize;
+			sum += sad.bytes(m_tcache + r*m_tcache_pitch, sysrc, m_mcache + r*m_tcache_pitch, m_tcache_pitch);
+		}
+#ifdef _DEBUG
+		// check: if both patches start at even pixels, it is the same as SAD of 3 channels of pixels,
+		// and SEA bound is not greater
+		char buf[100];
+		if(sum<=bound && ((x-winxsize)&1)==0 && ((y-winysize)&1)==0 && ((i-winxsize)&1)==0 && ((j-winysize)&1)==0
+			&& sum != PixelSAD(x, y, i, j))
+		{
+			wsprintf(buf,"ExInpaint: YV12 SAD=%d, pixel SAD=%d, x=%d, y=%d, i=%d, j=%d", (int)sum, (int)PixelSAD(x, y, i, j), x, y, i, j);
+			OutputDebugString(buf);
+		}
+		if(sum<=bound && m_blockx==x && m_blocky==y && PatchBound(i-x, j-y)>sum)
+		{
+			wsprintf(buf,"ExInpaint: YV12 SAD=%d, bound=%d, x=%d, y=%d, i=%d, j=%d", (int)sum, (int)PatchBound(i-x, j-y), x, y, i, j);
+			OutputDebugString(buf);
+		}
+#endif
+	}
+	else if(m_planes) // interleaved RGB (or YUV24), target rows of planes are cached by CacheTarget
+	{
+		int n = winxsize*2;
+		for(int r=0; r<m_nrows && sum<=bound; r++)
+		{
+			unsigned char * syplane = m_planes + (j+m_rows[r])*3*m_ppitch + i-winxsize;
+			sum += sad.planes(m_tcache + r*m_tcache_pitch, syplane, m_mcache + r*m_tcache_pitch, n, m_ppitch); // it is the most time-comsuming part of code
+		}
+	}
+	else if(pixel_format == YUY2) // (YUY2 clips are processed as YUV24 by filter, so it is plain C)
+	{
+		for(int r=0; r<m_nrows && sum<=bound; r++)
+		{
+			source_y = j+m_rows[r];
+			target_y = y+m_rows[r];
+
+			unsigned char * tysrc = psrc + target_y*src_pitch;
+			unsigned char * sysrc = psrc + source_y*src_pitch;
+			unsigned char * tymark = m_mark + target_y*m_mpitch;
+
+			for(int iter_x=(-1)*winxsize; iter_x<winxsize; iter_x++)
+			{
+				source_x = i+iter_x;
+				target_x = x+iter_x;
+
+				if(tymark[target_x]==SOURCE) // compare (outside pixels are not source)
+				{
+					int tx4 = (target_x>>1)<<2; // mult 4
+					int tU = *(tysrc + tx4 + 1);
+					int tV = *(tysrc + tx4 + 3);
+					int tY = *(tysrc + (target_x<<1));
+					int sx4 = (source_x>>1)<<2; // mult 4
+					int sY = *(sysrc + (source_x<<1));
+					int sU = *(sysrc + sx4 + 1);
+					int sV = *(sysrc + sx4 + 3);
+					int temp_y = tY - sY;
+					int temp_u = tU - sU;
+					int temp_v = tV - sV;
+
+					sum += (abs(temp_y) + abs(temp_u) + abs(temp_v)) ; // SAD
+				}
+			}
+		}
+	}
+	return sum;
+}
+
+/*********************************************************************/
+void inpainting::PixelChannels(int x, int y, int *c)
+{
+	// get 3 channels of pixel, for YV12 and YUY2 chroma of luma pixel
+	if(pixel_format == RGB32 || pixel_format == RGBA)
+	{
+		unsigned char * p = psrc + y*src_pitch + x*4;
+		c[0] = p[0]; c[1] = p[1]; c[2] = p[2];
+	}
+	else if (pixel_format == RGB24 || pixel_format == YUV24)
+	{
+		unsigned char * p = psrc + y*src_pitch + x*3;
+		c[0] = p[0]; c[1] = p[1]; c[2] = p[2];
+	}
+	else if (pixel_format == YV12)
+	{
+		c[0] = psrc[y*src_pitch + x];
+		c[1] = psrcU[(y>>1)*src_pitchUV + (x>>1)];
+		c[2] = psrcV[(y>>1)*src_pitchUV + (x>>1)];
+	}
+	else if (pixel_format == YUY2)
+	{
+		unsigned char * p = psrc + y*src_pitch;
+		c[0] = p[x<<1];
+		c[1] = p[((x>>1)<<2) + 1];
+		c[2] = p[((x>>1)<<2) + 3];
+	}
+}
+
+#ifdef _DEBUG
+/*********************************************************************/
+long inpainting::PixelSAD(int x, int y, int i, int j)
+{
+	// plain SAD of 3 channels of every known target pixel (chroma of YV12 as of its luma pixels)
+	long sum = 0;
+	for(int iter_y=-winysize; iter_y<winysize; iter_y++)
+		for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
+		{
+			if(m_mark[(y+iter_y)*m_mpitch+x+iter_x]!=SOURCE)
+				continue;
+			int t[3], c[3];
+			PixelChannels(x+iter_x, y+iter_y, t);
+			PixelChannels(i+iter_x, j+iter_y, c);
+			sum += abs(t[0]-c[0]) + abs(t[1]-c[1]) + abs(t[2]-c[2]);
+		}
+	return sum;
+}
+#endif
+
+/*********************************************************************/
+void inpainting::Integrate(void)
+{
+	// integral images (summed area tables) of 3 channels for SEA lower bound of SAD.
+	// Unsigned overflow is not a problem, since differences of sums are small.
+	// Only sums in source patches are used, they are not changed by inpainting.
+	int sat_pitch = (m_width+1)*3;
+	memset(m_sat, 0, sat_pitch*sizeof(unsigned int)); // top row
+	for(int y = 0; y<m_height; y++)
+	{
+		unsigned int * prev = m_sat + y*sat_pitch;
+		unsigned int * cur = prev + sat_pitch;
+		unsigned int rowsum[3] = {0, 0, 0};
+		cur[0] = cur[1] = cur[2] = 0;
+		for(int x = 0; x<m_width; x++)
+		{
+			int c[3];
+			PixelChannels(x, y, c);
+			for(int k = 0; k<3; k++)
+			{
+				rowsum[k] += c[k];
+				cur[(x+1)*3+k] = prev[(x+1)*3+k] + rowsum[k];
+			}
+		}
+	}
+	if (search_mode != SEARCH_LUMA)
+		return;
+	// and of gray for luma search
+	memset(m_graysat, 0, (m_width+1)*sizeof(unsigned int));
+	for(int y = 0; y<m_height; y++)
+	{
+		unsigned int * prev = m_graysat + y*(m_width+1);
+		unsigned int * cur = prev + m_width+1;
+		const unsigned char * gray = m_gray + y*m_width;
+		unsigned int rowsum = 0;
+		cur[0] = 0;
+		for(int x = 0; x<m_width; x++)
+		{
+			rowsum += gray[x];
+			cur[x+1] = prev[x+1] + rowsum;
+		}
+	}
+}
+
+/*********************************************************************/
+void inpainting::TargetBlocks(int x, int y)
+{
+	// split known pixels of target patch to rectangle blocks for PatchBound:
+	// runs of known pixels in every row, merged with same runs of next rows.
+	// Finer blocks (single runs, MSEA) give tighter bound, but it is not worth its cost here
+	m_nblocks = 0;
+	int first = 0; // first block which may be continued by current row
+	for(int iter_y=-winysize; iter_y<winysize; iter_y++)
+	{
+		int target_y = y+iter_y;
+		unsigned char * tymark = m_mark + target_y*m_mpitch;
+		int nblocks_prev = m_nblocks;
+		int xend = x+winxsize;
+		for(int target_x = x-winxsize; target_x<xend; target_x++) // outside pixels are not source
+		{
+			if(tymark[target_x]!=SOURCE)
+				continue;
+			block run;
+			run.x0 = target_x;
+			run.y0 = target_y;
+			run.sum[0] = run.sum[1] = run.sum[2] = 0;
+			for(; target_x<xend && tymark[target_x]==SOURCE; target_x++)
+			{
+				int c[3];
+				PixelChannels(target_x, target_y, c);
+				run.sum[0] += c[0];
+				run.sum[1] += c[1];
+				run.sum[2] += c[2];
+			}
+			run.x1 = target_x;
+			run.y1 = target_y+1;
+
+			int b;
+			for(b = first; b<nblocks_prev; b++) // same run in previous row?
+				if(m_blocks[b].x0==run.x0 && m_blocks[b].x1==run.x1 && m_blocks[b].y1==target_y)
+					break;
+			if(b<nblocks_prev)
+			{
+				m_blocks[b].y1++;
+				m_blocks[b].sum[0] += run.sum[0];
+				m_blocks[b].sum[1] += run.sum[1];
+				m_blocks[b].sum[2] += run.sum[2];
+			}
+			else
+				m_blocks[m_nblocks++] = run;
+		}
+		// blocks not continued by this row are finished
+		int b2 = first;
+		for(int b = first; b<m_nblocks; b++)
+			if(m_blocks[b].y1 != target_y+1)
+			{
+				block temp = m_blocks[b];
+				m_blocks[b] = m_blocks[b2];
+				m_blocks[b2++] = temp;
+			}
+		first = b2;
+	}
+
+	m_nlumablocks = m_nblocks;
+	m_blockx = x;
+	m_blocky = y;
+	if(pixel_format == YV12)
+	{
+		// only luma sums of blocks above are used, chroma is compared at chroma resolution:
+		// runs of fully known chroma samples of rows cached by CacheTarget, as blocks of their luma pixels.
+		// Last sample of row is a block of its own, since it is not compared with source patch of other parity
+		int cw = m_tcache_pitchUV;
+		int cx0 = (x-winxsize+1)>>1;
+		int cy0 = (y-winysize+1)>>1;
+		unsigned char * tc = m_tcache + winysize*2*m_tcache_pitch;
+		unsigned char * mc = m_mcache + winysize*2*m_tcache_pitch;
+		for(int r=0; r<m_ncrows; r++, tc += cw*2, mc += cw*2)
+			for(int k=0; k<cw; )
+			{
+				if(mc[k]==0)
+				{
+					k++;
+					continue;
+				}
+				int kend = (k<cw-1) ? cw-1 : cw;
+				block run;
+				run.x0 = (cx0+k)*2;
+				run.y0 = (cy0 + m_crows[r])*2;
+				run.sum[0] = run.sum[1] = run.sum[2] = 0;
+				for(; k<kend && mc[k]; k++)
+				{
+					run.sum[1] += tc[k]*4; // as for 4 luma pixels
+					run.sum[2] += tc[cw+k]*4;
+				}
+				run.x1 = (cx0+k)*2;
+				run.y1 = run.y0+2;
+				m_blocks[m_nblocks++] = run;
+			}
+	}
+}
+
+/*********************************************************************/
+long inpainting::PatchBound(int dx, int dy)
+{
+	// successive elimination (SEA) lower bound of SAD of target patch and source patch shifted by dx, dy:
+	// sum of absolute differences of target and source block sums
+	int sat_pitch = (m_width+1)*3;
+	int channels = (pixel_format == YV12) ? 1 : 3; // only luma of YV12 pixel blocks
+	long lb = 0;
+	for(int b = 0; b<m_nlumablocks; b++)
+	{
+		const block * bl = m_blocks + b;
+		const unsigned int * p00 = m_sat + (bl->y0+dy)*sat_pitch + (bl->x0+dx)*3;
+		const unsigned int * p01 = p00 + (bl->x1-bl->x0)*3;
+		const unsigned int * p10 = p00 + (bl->y1-bl->y0)*sat_pitch;
+		const unsigned int * p11 = p10 + (bl->x1-bl->x0)*3;
+		for(int k = 0; k<channels; k++)
+		{
+			int s = (int)(p11[k] - p10[k] - p01[k] + p00[k]);
+			lb += abs(bl->sum[k] - s);
+		}
+	}
+	if(m_nblocks > m_nlumablocks) // YV12 chroma blocks, source is shifted by whole chroma samples as in PatchSAD
+	{
+		int cx0 = (m_blockx-winxsize+1)>>1;
+		int cy0 = (m_blocky-winysize+1)>>1;
+		int sx0 = (m_blockx+dx-winxsize+1)>>1;
+		int sy0 = (m_blocky+dy-winysize+1)>>1;
+		int cdx = (sx0-cx0)*2;
+		int cdy = (sy0-cy0)*2;
+		int xend = (cx0 + MIN(m_tcache_pitchUV, ((m_blockx+dx+winxsize)>>1) - sx0))*2; // samples compared by PatchSAD
+		int yend = (cy0 + ((m_blocky+dy+winysize)>>1) - sy0)*2;
+		for(int b = m_nlumablocks; b<m_nblocks; b++)
+		{
+			const block * bl = m_blocks + b;
+			if(bl->x0>=xend || bl->y0>=yend)
+				continue;
+			const unsigned int * p00 = m_sat + (bl->y0+cdy)*sat_pitch + (bl->x0+cdx)*3;
+			const unsigned int * p01 = p00 + (bl->x1-bl->x0)*3;
+			const unsigned int * p10 = p00 + (bl->y1-bl->y0)*sat_pitch;
+			const unsigned int * p11 = p10 + (bl->x1-bl->x0)*3;
+			for(int k = 1; k<3; k++)
+			{
+				int s = (int)(p11[k] - p10[k] - p01[k] + p00[k]);
+				lb += abs(bl->sum[k] - s);
+			}
+		}
+	}
+	return lb;
+}
+
+/*********************************************************************/
+bool inpainting::TryPatch(int x, int y, int i, int j, long &min, int &best)
+{
+	// compare source patch (i,j) if it is valid and inside search rectangle, remember it if better
+	if(i<m_xmin || i>=m_xmax || j<m_ymin || j>=m_ymax || m_source[j*m_width+i]==0)
+		return false;
+	long sum = PatchSAD(x, y, i, j, min); // will be > min if aborted
+	if(sum<min || (sum==min && j*m_width+i<best))
+	{
+		min = sum;
+		best = j*m_width+i;
+		return true;
+	}
+	return false;
+}
+
+/*********************************************************************/
+int inpainting::Random(int n)
+{
+	// pseudo-random number 0..n-1 (LCG, repeatable for every frame)
+	m_random = m_random*1103515245 + 12345;
+	return (int)((m_random>>8) % (unsigned int)n);
+}
+
+/*********************************************************************/
+void inpainting::PatchMatch(int x, int y, long &min, int &best)
+{
+	// approximate search (PatchMatch): candidates from nearest neighbour field of target and its filled neighbours
+	// (propagation), then random search around best with decreasing window for some iterations
+	if(m_nnf[y*m_width+x]>=0)
+	{
+		int n = m_nnf[y*m_width+x];
+		TryPatch(x, y, n%m_width, n/m_width, min, best);
+	}
+	if(coherence<=0) // (otherwise they are already tried)
+		CoherentPatches(x, y, min, best); // sources of all filled pixels of target patch, shifted to target
+	for(int ny = MAX(y-1, 0); ny<=MIN(y+1, m_height-1); ny++)
+		for(int nx = MAX(x-1, 0); nx<=MIN(x+1, m_width-1); nx++)
+		{
+			int n = m_nnf[ny*m_width+nx];
+			if(n>=0) // patch of neighbour, shifted to target
+				TryPatch(x, y, n%m_width + x-nx, n/m_width + y-ny, min, best);
+		}
+
+	int wmax = MAX(m_xmax-m_xmin, m_ymax-m_ymin);
+	if(best<0) // no good candidate yet, try random ones
+		for(int k = 0; k<wmax && best<0; k++)
+			TryPatch(x, y, m_xmin + Random(m_xmax-m_xmin), m_ymin + Random(m_ymax-m_ymin), min, best);
+	if(best<0)
+		return;
+
+	for(int iter = 0; iter<iterations; iter++)
+	{
+		int bx = best%m_width;
+		int by = best/m_width;
+		for(int w = wmax; w>=1; w/=2)
+			TryPatch(x, y, bx + Random(2*w+1) - w, by + Random(2*w+1) - w, min, best);
+	}
+	m_nnf[y*m_width+x] = best;
+}
+
+/*********************************************************************/
+void inpainting::UpdateField(int target_x, int target_y, int source_x, int source_y)
+{
+	// record source patch of pixels to be filled by update, as nearest neighbour field
+	for(int iter_y=MAX(-winysize, -target_y); iter_y<MIN(winysize, m_height-target_y); iter_y++)
+		for(int iter_x=MAX(-winxsize, -target_x); iter_x<MIN(winxsize, m_width-target_x); iter_x++)
+			if(m_mark[(target_y+iter_y)*m_mpitch + target_x+iter_x]!=SOURCE)
+				m_nnf[(target_y+iter_y)*m_width + target_x+iter_x] = (source_y+iter_y)*m_width + source_x+iter_x;
+}
+
+/*********************************************************************/
+void inpainting::CoherentPatches(int x, int y, long &min, int &best)
+{
+	// try source patches coherent with filled pixels of target patch: source of filled pixel shifted to target
+	int ncoherent = 0;
+	for(int iter_y=MAX(-winysize, -y); iter_y<MIN(winysize, m_height-y); iter_y++)
+	{
+		for(int iter_x=MAX(-winxsize, -x); iter_x<MIN(winxsize, m_width-x); iter_x++)
+		{
+			int n = m_nnf[(y+iter_y)*m_width + x+iter_x];
+			if(n<0 || m_mark[(y+iter_y)*m_mpitch + x+iter_x]!=SOURCE)
+				continue; // not filled yet (or original source)
+			n -= iter_y*m_width + iter_x; // source of target
+			int k;
+			for(k = ncoherent-1; k>=0 && m_coherent[k]!=n; k--); // already tried? (usually last)
+			if(k>=0)
+				continue;
+			m_coherent[ncoherent++] = n;
+			TryPatch(x, y, n%m_width, n/m_width, min, best);
+		}
+	}
+}
+
+/*********************************************************************/
+void inpainting::PatchDescriptor(int i, int j, float *d)
+{
+	// descriptor of source patch (i,j): mean channels of ANN_GRID*ANN_GRID cells, from integral images
+	int sat_pitch = (m_width+1)*3;
+	for(int cy = 0; cy<m_ann_gy; cy++)
+		for(int cx = 0; cx<m_ann_gx; cx++)
+		{
+			const unsigned int * p00 = m_sat + (j+m_ann_y[cy])*sat_pitch + (i+m_ann_x[cx])*3;
+			const unsigned int * p01 = p00 + (m_ann_x[cx+1]-m_ann_x[cx])*3;
+			const unsigned int * p10 = p00 + (m_ann_y[cy+1]-m_ann_y[cy])*sat_pitch;
+			const unsigned int * p11 = p10 + (m_ann_x[cx+1]-m_ann_x[cx])*3;
+			float area = (float)((m_ann_x[cx+1]-m_ann_x[cx])*(m_ann_y[cy+1]-m_ann_y[cy]));
+			for(int k = 0; k<3; k++)
+				*d++ = (int)(p11[k] - p10[k] - p01[k] + p00[k])/area;
+		}
+}
+
+/*********************************************************************/
+static void Jacobi(double *a, int n, double *v)
+{
+	// eigen decomposition of symmetric matrix a (n*n) by Jacobi rotations:
+	// eigenvalues are on diagonal of a, eigenvectors are columns of v
+	for(int i = 0; i<n; i++)
+		for(int j = 0; j<n; j++)
+			v[i*n+j] = (i==j);
+	for(int sweep = 0; sweep<50; sweep++)
+	{
+		double off = 0;
+		for(int p = 0; p<n; p++)
+			for(int q = p+1; q<n; q++)
+				off += a[p*n+q]*a[p*n+q];
+		if(off < 1e-12)
+			break;
+		for(int p = 0; p<n; p++)
+			for(int q = p+1; q<n; q++)
+			{
+				if(fabs(a[p*n+q]) < 1e-30)
+					continue;
+				double theta = (a[q*n+q] - a[p*n+p])/(2*a[p*n+q]);
+				double t = (theta>=0 ? 1 : -1)/(fabs(theta) + sqrt(theta*theta + 1));
+				double c = 1/sqrt(t*t + 1);
+				double s = t*c;
+				for(int k = 0; k<n; k++) // rotate columns p, q
+				{
+					double akp = a[k*n+p], akq = a[k*n+q];
+					a[k*n+p] = c*akp - s*akq;
+					a[k*n+q] = s*akp + c*akq;
+				}
+				for(int k = 0; k<n; k++) // rotate rows p, q
+				{
+					double apk = a[p*n+k], aqk = a[q*n+k];
+					a[p*n+k] = c*apk - s*aqk;
+					a[q*n+k] = s*apk + c*aqk;
+				}
+				for(int k = 0; k<n; k++)
+				{
+					double vkp = v[k*n+p], vkq = v[k*n+q];
+					v[k*n+p] = c*vkp - s*vkq;
+					v[k*n+q] = s*vkp + c*vkq;
+				}
+			}
+	}
+}
+
+/*********************************************************************/
+void inpainting::BuildIndex(void)
+{
+	// approximate nearest neighbour index of valid source patches for mode ANN:
+	// patch descriptors are projected to ANN_DIMS principal components and stored in kd-tree.
+	// Valid sources are not changed during frame processing, so index is built once per frame.
+	m_ann_gx = MIN(ANN_GRID, winxsize*2);
+	m_ann_gy = MIN(ANN_GRID, winysize*2);
+	for(int k = 0; k<=m_ann_gx; k++)
+		m_ann_x[k] = -winxsize + (winxsize*2*k)/m_ann_gx;
+	for(int k = 0; k<=m_ann_gy; k++)
+		m_ann_y[k] = -winysize + (winysize*2*k)/m_ann_gy;
+	int dims = m_ann_gx*m_ann_gy*3;
+
+	m_ann_count = 0;
+	for(int n = 0; n<m_width*m_height; n++)
+		m_ann_count += m_source[n];
+	delete [] m_ann_index;
+	delete [] m_ann_points;
+	delete [] m_ann_split;
+	m_ann_index = new int[m_ann_count+1];
+	m_ann_points = new float[(m_ann_count+1)*ANN_DIMS];
+	m_ann_split = new unsigned char[m_ann_count+1];
+	if(m_ann_count==0)
+		return;
+
+	// principal components of descriptors of some sample patches
+	double * cov = new double[dims*dims];
+	double * vec = new double[dims*dims];
+	double mean[ANN_GRID*ANN_GRID*3];
+	float d[ANN_GRID*ANN_GRID*3];
+	memset(cov, 0, dims*dims*sizeof(double));
+	memset(mean, 0, sizeof(mean));
+	int step = MAX(m_ann_count/4096, 1);
+	int samples = 0;
+	int count = 0;
+	for(int n = 0; n<m_width*m_height; n++)
+	{
+		if(m_source[n]==0 || (count++)%step)
+			continue;
+		PatchDescriptor(n%m_width, n/m_width, d);
+		for(int k = 0; k<dims; k++)
+		{
+			mean[k] += d[k];
+			for(int l = 0; l<=k; l++)
+				cov[k*dims+l] += (double)d[k]*d[l];
+		}
+		samples++;
+	}
+	for(int k = 0; k<dims; k++)
+		mean[k] /= samples;
+	for(int k = 0; k<dims; k++)
+		for(int l = 0; l<=k; l++)
+			cov[l*dims+k] = cov[k*dims+l] = cov[k*dims+l]/samples - mean[k]*mean[l];
+	Jacobi(cov, dims, vec);
+	bool * used = new bool[dims];
+	memset(used, 0, dims*sizeof(bool));
+	for(int c = 0; c<ANN_DIMS; c++) // components with largest eigenvalues
+	{
+		int kmax = -1;
+		for(int k = 0; k<dims; k++)
+			if(!used[k] && (kmax<0 || cov[k*dims+k]>cov[kmax*dims+kmax]))
+				kmax = k;
+		for(int k = 0; k<dims; k++)
+			m_ann_basis[c][k] = (kmax>=0) ? (float)vec[k*dims+kmax] : 0; // zero if less dims than components
+		if(kmax>=0)
+			used[kmax] = true;
+	}
+	for(int k = 0; k<dims; k++)
+		m_ann_mean[k] = (float)mean[k];
+	delete [] used;
+	delete [] vec;
+	delete [] cov;
+
+	// project all valid sources
+	count = 0;
+	for(int n = 0; n<m_width*m_height; n++)
+	{
+		if(m_source[n]==0)
+			continue;
+		PatchDescriptor(n%m_width, n/m_width, d);
+		float * p = m_ann_points + count*ANN_DIMS;
+		for(int c = 0; c<ANN_DIMS; c++)
+		{
+			float s = 0;
+			for(int k = 0; k<dims; k++)
+				s += m_ann_basis[c][k]*(d[k] - m_ann_mean[k]);
+			p[c] = s;
+		}
+		m_ann_index[count++] = n;
+	}
+	BuildTree(0, m_ann_count);
+}
+
+/*********************************************************************/
+void inpainting::BuildTree(int lo, int hi)
+{
+	// implicit balanced kd-tree: node of range [lo,hi) is its middle point, split by dimension of largest spread
+	if(hi-lo<=1)
+		return;
+	int mid = (lo+hi)/2;
+	float pmin[ANN_DIMS], pmax[ANN_DIMS];
+	for(int c = 0; c<ANN_DIMS; c++)
+		pmin[c] = pmax[c] = m_ann_points[lo*ANN_DIMS+c];
+	for(int n = lo+1; n<hi; n++)
+		for(int c = 0; c<ANN_DIMS; c++)
+		{
+			pmin[c] = MIN(pmin[c], m_ann_points[n*ANN_DIMS+c]);
+			pmax[c] = MAX(pmax[c], m_ann_points[n*ANN_DIMS+c]);
+		}
+	int dim = 0;
+	for(int c = 1; c<ANN_DIMS; c++)
+		if(pmax[c]-pmin[c] > pmax[dim]-pmin[dim])
+			dim = c;
+	m_ann_split[mid] = (unsigned char)dim;
+
+	// select median to mid (quickselect), swapping points and indexes
+	int l = lo, r = hi-1;
+	while(l<r)
+	{
+		float pivot = m_ann_points[((l+r)/2)*ANN_DIMS+dim];
+		int a = l, b = r;
+		while(a<=b)
+		{
+			while(m_ann_points[a*ANN_DIMS+dim] < pivot) a++;
+			while(m_ann_points[b*ANN_DIMS+dim] > pivot) b--;
+			if(a<=b)
+			{
+				for(int c = 0; c<ANN_DIMS; c++)
+				{
+					float t = m_ann_points[a*ANN_DIMS+c];
+					m_ann_points[a*ANN_DIMS+c] = m_ann_points[b*ANN_DIMS+c];
+					m_ann_points[b*ANN_DIMS+c] = t;
+				}
+				int t = m_ann_index[a]; m_ann_index[a] = m_ann_index[b]; m_ann_index[b] = t;
+				a++;
+				b--;
+			}
+		}
+		if(mid<=b) r = b;
+		else if(mid>=a) l = a;
+		else break;
+	}
+	BuildTree(lo, mid);
+	BuildTree(mid+1, hi);
+}
+
+/*********************************************************************/
+void inpainting::SearchTree(int lo, int hi, const float *q)
+{
+	// nearest points of kd-tree to q inside search rectangle, to sorted shortlist
+	if(hi<=lo)
+		return;
+	int mid = (lo+hi)/2;
+	const float * p = m_ann_points + mid*ANN_DIMS;
+	int n = m_ann_index[mid];
+	int i = n%m_width, j = n/m_width;
+	if(i>=m_xmin && i<m_xmax && j>=m_ymin && j<m_ymax)
+	{
+		float dist = 0;
+		for(int c = 0; c<ANN_DIMS; c++)
+			dist += (p[c]-q[c])*(p[c]-q[c]);
+		if(m_ann_nbest<ANN_SHORTLIST || dist<m_ann_dist[m_ann_nbest-1])
+		{
+			int k = MIN(m_ann_nbest, ANN_SHORTLIST-1); // insert sorted
+			for(; k>0 && m_ann_dist[k-1]>dist; k--)
+			{
+				m_ann_dist[k] = m_ann_dist[k-1];
+				m_ann_best[k] = m_ann_best[k-1];
+			}
+			m_ann_dist[k] = dist;
+			m_ann_best[k] = n;
+			m_ann_nbest = MIN(m_ann_nbest+1, ANN_SHORTLIST);
+		}
+	}
+	if(hi-lo<=1)
+		return;
+	int dim = m_ann_split[mid];
+	float diff = q[dim] - p[dim];
+	if(diff<0) // near side first
+		SearchTree(lo, mid, q);
+	else
+		SearchTree(mid+1, hi, q);
+	if(m_ann_nbest<ANN_SHORTLIST || diff*diff<m_ann_dist[m_ann_nbest-1])
+	{
+		if(diff<0)
+			SearchTree(mid+1, hi, q);
+		else
+			SearchTree(lo, mid, q);
+	}
+}
+
+/*********************************************************************/
+void inpainting::AnnSearch(int x, int y, long &min, int &best)
+{
+	// approximate search by index: descriptor of known cells of target is re-projected to principal components
+	// (least squares fit), then shortlist of nearest indexed patches is re-ranked by exact masked SAD
+	if(m_ann_count<0)
+		BuildIndex(); // at first use in frame
+	int dims = m_ann_gx*m_ann_gy*3;
+	float v[ANN_GRID*ANN_GRID*3];
+	bool known[ANN_GRID*ANN_GRID];
+	int nknown = 0;
+	for(int pass = 0; pass<2 && nknown==0; pass++) // cells at least half known, or any known if none
+		for(int cy = 0; cy<m_ann_gy; cy++)
+			for(int cx = 0; cx<m_ann_gx; cx++)
+			{
+				int sum[3] = {0, 0, 0};
+				int count = 0;
+				for(int target_y = y+m_ann_y[cy]; target_y<y+m_ann_y[cy+1]; target_y++)
+					for(int target_x = x+m_ann_x[cx]; target_x<x+m_ann_x[cx+1]; target_x++)
+						if(m_mark[target_y*m_mpitch+target_x]==SOURCE) // outside pixels are not source
+						{
+							int c[3];
+							PixelChannels(target_x, target_y, c);
+							sum[0] += c[0]; sum[1] += c[1]; sum[2] += c[2];
+							count++;
+						}
+				int cell = cy*m_ann_gx+cx;
+				int area = (m_ann_x[cx+1]-m_ann_x[cx])*(m_ann_y[cy+1]-m_ann_y[cy]);
+				known[cell] = (count>0 && (pass>0 || count*2>=area));
+				nknown += known[cell];
+				for(int k = 0; k<3; k++)
+					v[cell*3+k] = count ? (float)sum[k]/count - m_ann_mean[cell*3+k] : 0;
+			}
+	if(nknown==0)
+		return;
+
+	// least squares: (B B' + eps) q = B v for known dims
+	double a[ANN_DIMS][ANN_DIMS+1];
+	for(int c = 0; c<ANN_DIMS; c++)
+	{
+		for(int e = 0; e<ANN_DIMS; e++)
+		{
+			double s = 0;
+			for(int k = 0; k<dims; k++)
+				if(known[k/3])
+					s += m_ann_basis[c][k]*m_ann_basis[e][k];
+			a[c][e] = s + (c==e)*0.01; // regularization for unknown components
+		}
+		double s = 0;
+		for(int k = 0; k<dims; k++)
+			if(known[k/3])
+				s += m_ann_basis[c][k]*v[k];
+		a[c][ANN_DIMS] = s;
+	}
+	for(int c = 0; c<ANN_DIMS; c++) // Gauss elimination, matrix is positive definite
+		for(int e = c+1; e<ANN_DIMS; e++)
+		{
+			double f = a[e][c]/a[c][c];
+			for(int k = c; k<=ANN_DIMS; k++)
+				a[e][k] -= f*a[c][k];
+		}
+	float q[ANN_DIMS];
+	for(int c = ANN_DIMS-1; c>=0; c--)
+	{
+		double s = a[c][ANN_DIMS];
+		for(int k = c+1; k<ANN_DIMS; k++)
+			s -= a[c][k]*q[k];
+		q[c] = (float)(s/a[c][c]);
+	}
+
+	m_ann_nbest = 0;
+	SearchTree(0, m_ann_count, q);
+	for(int k = 0; k<m_ann_nbest; k++)
+		TryPatch(x, y, m_ann_best[k]%m_width, m_ann_best[k]/m_width, min, best);
+}
+
+/*********************************************************************/
+static void InsertHit(int *hits, long *hitsad, int &nhits, int maxhits, int hit, long sad)
+{
+	// insert patch to sorted list of best ones (first is better for equal)
+	if(nhits==maxhits && sad>=hitsad[nhits-1])
+		return;
+	int k = MIN(nhits, maxhits-1);
+	for(; k>0 && hitsad[k-1]>sad; k--)
+	{
+		hits[k] = hits[k-1];
+		hitsad[k] = hitsad[k-1];
+	}
+	hits[k] = hit;
+	hitsad[k] = sad;
+	nhits = MIN(nhits+1, maxhits);
+}
+
+/*********************************************************************/
+static void FFT(double *a, int n, int stride, int count, const double *w, int wn, bool inverse)
+{
+	// in-place radix-2 complex FFT of n (power of 2) elements (re,im pairs) with distance stride (in elements),
+	// for count neighbour transforms at once (e.g. all columns of image, with row-wise memory access).
+	// Not normalized. w is table of wn/2 roots exp(-2*pi*i*k/wn), wn is multiple of n
+	for(int i = 1, j = 0; i<n; i++) // bit reversal permutation
+	{
+		int bit = n>>1;
+		for(; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if(i<j)
+		{
+			double * u = a + 2*i*stride;
+			double * v = a + 2*j*stride;
+			for(int c = 0; c<2*count; c++)
+			{
+				double t = u[c]; u[c] = v[c]; v[c] = t;
+			}
+		}
+	}
+	for(int len = 2; len<=n; len<<=1)
+	{
+		int step = wn/len;
+		for(int k = 0; k<len/2; k++)
+		{
+			double wr = w[2*k*step];
+			double wi = inverse ? -w[2*k*step+1] : w[2*k*step+1];
+			for(int i = 0; i<n; i += len)
+			{
+				double * u = a + 2*(i+k)*stride;
+				double * v = a + 2*(i+k+len/2)*stride;
+				for(int c = 0; c<2*count; c += 2)
+				{
+					double vr = v[c]*wr - v[c+1]*wi;
+					double vi = v[c]*wi + v[c+1]*wr;
+					v[c] = u[c] - vr; v[c+1] = u[c+1] - vi;
+					u[c] += vr; u[c+1] += vi;
+				}
+			}
+		}
+	}
+}
+
+/*********************************************************************/
+void inpainting::FFT2(double *a, int rows, bool inverse)
+{
+	// 2D FFT of m_fft_n x m_fft_n complex image, only first rows are not zero
+	for(int r = 0; r<rows; r++)
+		FFT(a + 2*r*m_fft_n, m_fft_n, 1, 1, m_fft_roots, m_fft_n, inverse);
+	FFT(a, m_fft_n, m_fft_n, m_fft_n, m_fft_roots, m_fft_n, inverse); // all columns
+}
+
+/*********************************************************************/
+void inpainting::FftInit(void)
+{
+	// tiles of frame for FftSearch. Tile of FFT size contains patches with centres in m_fft_sx x m_fft_sy area
+	// (correlation at their shifts does not wrap), so tiles overlap by patch size and every source patch is in one tile.
+	// Spectra of tile are computed when it is used first in frame.
+	int n, logn;
+	for(n = 64, logn = 6; n<FFT_TILE*MAX(winxsize, winysize)*2; n<<=1, logn++);
+	int sx = n - winxsize*2 + 1;
+	int sy = n - winysize*2 + 1;
+	int tx = MAX(m_width - winxsize*2 + sx, sx)/sx; // centres from winxsize to m_width-winxsize
+	int ty = MAX(m_height - winysize*2 + sy, sy)/sy;
+	if(n != m_fft_n || tx*ty != m_fft_tx*m_fft_ty) // patch size is changed
+	{
+		for(int t = 0; t<m_fft_tx*m_fft_ty && m_fft_tile; t++)
+			delete [] m_fft_tile[t];
+		delete [] m_fft_tile;
+		delete [] m_fft_done;
+		delete [] m_fft_t1;
+		delete [] m_fft_t2;
+		delete [] m_fft_corr;
+		delete [] m_fft_roots;
+		m_fft_tile = new double * [tx*ty];
+		for(int t = 0; t<tx*ty; t++)
+			m_fft_tile[t] = 0;
+		m_fft_done = new unsigned char[tx*ty];
+		m_fft_t1 = new double[2*n*n];
+		m_fft_t2 = new double[2*n*n];
+		m_fft_corr = new double[2*n*n];
+		m_fft_roots = new double[n];
+		for(int k = 0; k<n/2; k++)
+		{
+			m_fft_roots[2*k] = cos(2*3.14159265358979323846*k/n);
+			m_fft_roots[2*k+1] = -sin(2*3.14159265358979323846*k/n);
+		}
+		m_fft_n = n;
+		m_fft_logn = logn;
+	}
+	m_fft_sx = sx;
+	m_fft_sy = sy;
+	m_fft_tx = tx;
+	m_fft_ty = ty;
+	memset(m_fft_done, 0, tx*ty);
+}
+
+/*********************************************************************/
+void inpainting::FftTile(int tile)
+{
+	// spectra of source channels of tile for FftSearch, two real images are packed to one complex:
+	// channels 0 + i*1, and channel 2 + i*(sum of squares of channels).
+	// Valid source patches are never changed, so they are computed once per frame
+	// (but for YV12 chroma sample can be shared with filled pixel, it is ignored).
+	int n = m_fft_n;
+	if(m_fft_tile[tile]==0)
+		m_fft_tile[tile] = new double[4*n*n];
+	double * src1 = m_fft_tile[tile];
+	double * src2 = src1 + 2*n*n;
+	int x0 = (tile%m_fft_tx)*m_fft_sx; // left top pixel of tile
+	int y0 = (tile/m_fft_tx)*m_fft_sy;
+	int w = MIN(n, m_width-x0); // zero outside of frame
+	int h = MIN(n, m_height-y0);
+	memset(src1, 0, 4*n*n*sizeof(double));
+	for(int y = 0; y<h; y++)
+		for(int x = 0; x<w; x++)
+		{
+			int c[3];
+			PixelChannels(x0+x, y0+y, c);
+			double * p1 = src1 + 2*(y*n+x);
+			double * p2 = src2 + 2*(y*n+x);
+			p1[0] = c[0];
+			p1[1] = c[1];
+			p2[0] = c[2];
+			p2[1] = c[0]*c[0] + c[1]*c[1] + c[2]*c[2];
+		}
+	FFT2(src1, h, false);
+	FFT2(src2, h, false);
+	m_fft_done[tile] = 1;
+}
+
+/*********************************************************************/
+double inpainting::FftCost(void)
+{
+	// per tile of search area: product of spectra and inverse FFT, and the same for template (two FFT).
+	// Spectra of new tiles are not counted, they are computed once per frame
+	int tiles = (MIN((m_xmax-1-winxsize)/m_fft_sx, m_fft_tx-1) - MAX(m_xmin-winxsize, 0)/m_fft_sx + 1)
+		* (MIN((m_ymax-1-winysize)/m_fft_sy, m_fft_ty-1) - MAX(m_ymin-winysize, 0)/m_fft_sy + 1);
+	return (double)FFT_COST*(tiles + 2)*m_fft_n*m_fft_n*m_fft_logn;
+}
+
+/*********************************************************************/
+void inpainting::FftSearch(int x, int y, long &min, int &best)
+{
+	// search by masked SSD of all shifts as correlation, by FFT in tiles covering search area:
+	// SSD = sum(m*t*t) - 2*sum(m*t*s) + sum(m*s*s), first term is constant, others are correlations
+	// of source channels with masked target and of source sum of squares with mask.
+	// Few best patches by SSD are compared by SAD, with candidates tried before.
+	int n = m_fft_n;
+
+	// target template at origin, packed as (-2*m*t0 - i*2*m*t1) and (-2*m*t2 + i*m), all correlations are summed.
+	// Template is not greater than tile
+	int rows = winysize*2;
+	memset(m_fft_t1, 0, 2*n*n*sizeof(double));
+	memset(m_fft_t2, 0, 2*n*n*sizeof(double));
+	for(int b = 0; b<rows; b++)
+		for(int a = 0; a<winxsize*2; a++)
+		{
+			int target_x = x-winxsize+a;
+			int target_y = y-winysize+b;
+			if(m_mark[target_y*m_mpitch+target_x]!=SOURCE) // or outside
+				continue;
+			int c[3];
+			PixelChannels(target_x, target_y, c);
+			double * p1 = m_fft_t1 + 2*(b*n+a);
+			double * p2 = m_fft_t2 + 2*(b*n+a);
+			p1[0] = -2*c[0];
+			p1[1] = -2*c[1];
+			p2[0] = -2*c[2];
+			p2[1] = 1;
+		}
+	FFT2(m_fft_t1, rows, false);
+	FFT2(m_fft_t2, rows, false);
+
+	int nhits = 0;
+	int hits[FFT_HITS];
+	long hitsad[FFT_HITS];
+	double scale = 1.0/((double)n*n);
+	for(int ty = MAX(m_ymin-winysize, 0)/m_fft_sy; ty<=MIN((m_ymax-1-winysize)/m_fft_sy, m_fft_ty-1); ty++)
+	for(int tx = MAX(m_xmin-winxsize, 0)/m_fft_sx; tx<=MIN((m_xmax-1-winxsize)/m_fft_sx, m_fft_tx-1); tx++)
+	{
+		int tile = ty*m_fft_tx + tx;
+		if(!m_fft_done[tile])
+			FftTile(tile);
+		const double * src1 = m_fft_tile[tile];
+		const double * src2 = src1 + 2*n*n;
+
+		// spectrum of correlation sum: sum of conj(T)*S over packed pairs of real images.
+		// For Z = F(a + i*b) and W = F(c + i*d): conj(F(a))*F(c) + conj(F(b))*F(d) = (conj(Z(k))*W(k) + Z(-k)*conj(W(-k)))/2
+		for(int ky = 0; ky<n; ky++)
+			for(int kx = 0; kx<n; kx++)
+			{
+				int k = ky*n + kx;
+				int nk = ((n-ky) & (n-1))*n + ((n-kx) & (n-1));
+				if(nk<k)
+					continue; // done with pair
+				double res[2][2] = {{0, 0}, {0, 0}};
+				for(int pack = 0; pack<2; pack++)
+				{
+					const double * z = pack ? m_fft_t2 : m_fft_t1;
+					const double * w = pack ? src2 : src1;
+					double zr = z[2*k], zi = z[2*k+1], znr = z[2*nk], zni = z[2*nk+1];
+					double wr = w[2*k], wi = w[2*k+1], wnr = w[2*nk], wni = w[2*nk+1];
+					// at k: conj(Z(k))*W(k) + Z(-k)*conj(W(-k))
+					res[0][0] += (zr*wr + zi*wi) + (znr*wnr + zni*wni);
+					res[0][1] += (zr*wi - zi*wr) + (zni*wnr - znr*wni);
+					// at -k: conj(Z(-k))*W(-k) + Z(k)*conj(W(k))
+					res[1][0] += (znr*wnr + zni*wni) + (zr*wr + zi*wi);
+					res[1][1] += (znr*wni - zni*wnr) + (zi*wr - zr*wi);
+				}
+				m_fft_corr[2*k] = res[0][0]/2; m_fft_corr[2*k+1] = res[0][1]/2;
+				m_fft_corr[2*nk] = res[1][0]/2; m_fft_corr[2*nk+1] = res[1][1]/2;
+			}
+		FFT2(m_fft_corr, n, true);
+
+		// valid sources of search area with centres in tile
+		int x0 = tx*m_fft_sx;
+		int y0 = ty*m_fft_sy;
+		int xmin = MAX(m_xmin, x0+winxsize), xmax = MIN(m_xmax, x0+winxsize+m_fft_sx);
+		for(int j = MAX(m_ymin, y0+winysize); j<MIN(m_ymax, y0+winysize+m_fft_sy); j++)
+			for(int k = FirstRun(j, xmin); k<m_rowruns[j+1] && m_runs[k*2]<xmax; k++)
+			for(int i = MAX(m_runs[k*2], xmin); i<MIN(m_runs[k*2+1], xmax); i++)
+			{
+				long sum = (long)floor(m_fft_corr[2*((j-winysize-y0)*n + i-winxsize-x0)]*scale + 0.5); // SSD without constant term
+				InsertHit(hits, hitsad, nhits, FFT_HITS, j*m_width+i, sum);
+			}
+	}
+
+	for(int k = 0; k<nhits; k++) // compare by SAD
+		TryPatch(x, y, hits[k]%m_width, hits[k]/m_width, min, best);
+}
+
+/*********************************************************************/
+void inpainting::UpdatePyramid(int left, int top, int right, int bottom)
+{
+	// recompute coarse pixels (means of scale*scale blocks) covering rectangle of frame [left,right) * [top,bottom).
+	// Coarse pixel is known only if all its pixels are known
+	int s = m_pyr_scale;
+	for(int cy = MAX(top/s, 0); cy<MIN((bottom+s-1)/s, m_pyr_h); cy++)
+		for(int cx = MAX(left/s, 0); cx<MIN((right+s-1)/s, m_pyr_w); cx++)
+		{
+			int sum[3] = {0, 0, 0};
+			bool known = true;
+			for(int y = cy*s; y<cy*s+s; y++)
+				for(int x = cx*s; x<cx*s+s; x++)
+				{
+					int c[3];
+					PixelChannels(x, y, c);
+					sum[0] += c[0]; sum[1] += c[1]; sum[2] += c[2];
+					known = known && (m_mark[y*m_mpitch+x]==SOURCE);
+				}
+			unsigned char * p = m_pyr + (cy*m_pyr_w+cx)*3;
+			p[0] = (unsigned char)((sum[0] + s*s/2)/(s*s));
+			p[1] = (unsigned char)((sum[1] + s*s/2)/(s*s));
+			p[2] = (unsigned char)((sum[2] + s*s/2)/(s*s));
+			m_pyr_mark[cy*m_pyr_w+cx] = known;
+		}
+}
+
+/*********************************************************************/
+int inpainting::CoarseKnown(int x, int y)
+{
+	// number of known coarse pixels in coarse patch of target, coarse frame is built at first call
+	int s = m_pyr_scale;
+	if(!m_pyr_ready)
+	{
+		delete [] m_pyr;
+		delete [] m_pyr_mark;
+		m_pyr_w = m_width/s;
+		m_pyr_h = m_height/s;
+		m_pyr = new unsigned char[m_pyr_w*m_pyr_h*3+1];
+		m_pyr_mark = new unsigned char[m_pyr_w*m_pyr_h+1];
+		UpdatePyramid(0, 0, m_width, m_height);
+		m_pyr_ready = true;
+	}
+	int cwx = MAX(winxsize/s, 1);
+	int cwy = MAX(winysize/s, 1);
+	int known = 0;
+	for(int ty = MAX(y/s-cwy, 0); ty<MIN(y/s+cwy, m_pyr_h); ty++)
+		for(int tx = MAX(x/s-cwx, 0); tx<MIN(x/s+cwx, m_pyr_w); tx++)
+			known += m_pyr_mark[ty*m_pyr_w+tx];
+	return known;
+}
+
+/*********************************************************************/
+void inpainting::PyramidSearch(int x, int y, long &min, int &best)
+{
+	// coarse to fine search: best few patches of downsampled frame, refined around them in full resolution
+	int s = m_pyr_scale;
+	int cwx = MAX(winxsize/s, 1); // coarse patch
+	int cwy = MAX(winysize/s, 1);
+	int cx = x/s;
+	int cy = y/s;
+
+	int nhits = 0;
+	int hits[PYR_HITS];
+	long hitsad[PYR_HITS];
+	for(int cj = (m_ymin+s-1)/s; cj*s<m_ymax && cj<m_pyr_h; cj++)
+		for(int ci = (m_xmin+s-1)/s; ci*s<m_xmax && ci<m_pyr_w; ci++)
+		{
+			if(m_source[(cj*s)*m_width + ci*s]==0)
+				continue;
+			long bound = (nhits<PYR_HITS) ? MIN_INITIAL : hitsad[nhits-1];
+			long sum = 0;
+			for(int iter_y = -cwy; iter_y<cwy && sum<=bound; iter_y++)
+			{
+				int ty = cy+iter_y;
+				int sy = cj+iter_y;
+				if(ty<0 || ty>=m_pyr_h || sy<0 || sy>=m_pyr_h)
+					continue;
+				for(int iter_x = -cwx; iter_x<cwx; iter_x++)
+				{
+					int tx = cx+iter_x;
+					int sx = ci+iter_x;
+					if(tx<0 || tx>=m_pyr_w || sx<0 || sx>=m_pyr_w || !m_pyr_mark[ty*m_pyr_w+tx])
+						continue;
+					const unsigned char * tp = m_pyr + (ty*m_pyr_w+tx)*3;
+					const unsigned char * sp = m_pyr + (sy*m_pyr_w+sx)*3;
+					sum += abs(tp[0]-sp[0]) + abs(tp[1]-sp[1]) + abs(tp[2]-sp[2]);
+				}
+			}
+			if(sum<=bound)
+				InsertHit(hits, hitsad, nhits, PYR_HITS, (cj*s)*m_width + ci*s, sum);
+		}
+
+	for(int k = 0; k<nhits; k++) // refine in full resolution
+		for(int j = hits[k]/m_width - s; j<=hits[k]/m_width + s; j++)
+			for(int i = hits[k]%m_width - s; i<=hits[k]%m_width + s; i++)
+				TryPatch(x, y, i, j, min, best);
+}
+
+/*********************************************************************/
+void inpainting::StrideSearch(int x, int y, long &min, int &best)
+{
+	// scan of every stride-th candidate in both directions, then full search around few best ones
+	int nhits = 0;
+	int hits[STRIDE_HITS];
+	long hitsad[STRIDE_HITS];
+	for(int j = m_ymin; j<m_ymax; j += stride)
+		for(int k = FirstRun(j, m_xmin); k<m_rowruns[j+1] && m_runs[k*2]<m_xmax; k++)
+		for(int i = m_xmin + (MAX(m_runs[k*2]-m_xmin, 0) + stride-1)/stride*stride; i<MIN(m_runs[k*2+1], m_xmax); i += stride)
+		{
+			long bound = (nhits<STRIDE_HITS) ? MIN_INITIAL : hitsad[nhits-1];
+			if(PatchBound(i-x, j-y) > bound)
+				continue;
+			long sum = PatchSAD(x, y, i, j, bound);
+			if(sum<=bound)
+				InsertHit(hits, hitsad, nhits, STRIDE_HITS, j*m_width+i, sum);
+		}
+
+	for(int k = 0; k<nhits; k++) // refine
+		for(int j = hits[k]/m_width - stride + 1; j<hits[k]/m_width + stride; j++)
+			for(int i = hits[k]%m_width - stride + 1; i<hits[k]%m_width + stride; i++)
+				TryPatch(x, y, i, j, min, best);
+}
+
+/*********************************************************************/
+int inpainting::KnownPixels(void)
+{
+	// number of known pixels in target patch (rows from SortRows)
+	int known = 0;
+	for(int r=0; r<m_nrows; r++)
+		known += m_rowknown[r];
+	return known;
+}
+
+/*********************************************************************/
+void inpainting::SpiralSearch(int x, int y, long &min, int &best)
+{
+	// search by square rings of increasing distance from target, stopped as soon as SAD per known pixel
+	// is less than accept threshold. Without threshold result is the same as of exact search.
+	long good = (long)accept*KnownPixels();
+	int dmax = MAX(MAX(x-m_xmin, m_xmax-1-x), MAX(y-m_ymin, m_ymax-1-y));
+	for(int d = 0; d<=dmax; d++)
+	{
+		for(int j = MAX(y-d, m_ymin); j<=MIN(y+d, m_ymax-1); j++)
+		{
+			int di = (j==y-d || j==y+d) ? 1 : 2*d; // full top and bottom rows, only ends of others
+			for(int i = x-d; i<=x+d; i += di)
+			{
+				if(i<m_xmin || i>=m_xmax || m_source[j*m_width+i]==0)
+					continue;
+				if(PatchBound(i-x, j-y) > min)
+					continue; // can not be better
+				if(TryPatch(x, y, i, j, min, best) && min<good)
+					return; // good enough
+			}
+		}
+	}
+}
+
+/*********************************************************************/
+void inpainting::LumaSearch(int x, int y, long &min, int &best)
+{
+	// scan of candidates by SAD of luma (gray) only, few best ones are compared by full colour SAD as soon as found.
+	// Luma SAD is not greater than colour SAD (gray is weighted mean of channels or one of them),
+	// so candidates with luma SAD (or its bound) above colour min are skipped too
+	TargetBlocks(x, y);
+	for(int b = 0; b<m_nlumablocks; b++) // gray sums of blocks of known pixels
+	{
+		block * bl = m_blocks + b;
+		bl->gray = 0;
+		for(int target_y = bl->y0; target_y<bl->y1; target_y++)
+			for(int target_x = bl->x0; target_x<bl->x1; target_x++)
+				bl->gray += m_gray[target_y*m_width+target_x];
+	}
+	int n = winxsize*2;
+	m_gy0 = winysize; // premasked gray rows from first to last row with known pixels, in order of frame
+	int gy1 = -winysize;
+	for(int r=0; r<m_nrows; r++)
+	{
+		m_gy0 = MIN(m_gy0, m_rows[r]);
+		gy1 = MAX(gy1, m_rows[r]+1);
+	}
+	m_gny = MAX(gy1-m_gy0, 0);
+	for(int r=0; r<m_gny; r++)
+	{
+		int target_y = y+m_gy0+r;
+		const unsigned char * tymark = m_mark + target_y*m_mpitch + x-winxsize;
+		const unsigned char * tygray = m_gray + target_y*m_width + x-winxsize;
+		unsigned char * tc = m_gcache + r*n;
+		unsigned char * mc = m_gmcache + r*n;
+		for(int k=0; k<n; k++)
+		{
+			bool known = (tymark[k]==SOURCE); // outside pixels of gray row are not read
+			tc[k] = known ? tygray[k] : 0;
+			mc[k] = known ? 0xFF : 0;
+		}
+	}
+
+	int nhits = 0;
+	int hits[LUMA_HITS];
+	long hitsad[LUMA_HITS];
+	int tile = MAX(SEARCH_TILE/(winysize*2+1) - winxsize*2, 16); // candidate columns, as in exact search
+	for(int i0 = m_xmin; i0<m_xmax; i0 += tile)
+	for(int j = m_ymin; j<m_ymax; j++)
+	{
+		int i1 = MIN(i0+tile, m_xmax);
+		for(int k = FirstRun(j, i0); k<m_rowruns[j+1] && m_runs[k*2]<i1; k++)
+		for(int i = MAX(m_runs[k*2], i0); i<MIN(m_runs[k*2+1], i1); i++) // valid sources only
+		{
+			long bound = (nhits<LUMA_HITS) ? min : MIN(min, hitsad[nhits-1]);
+			if(LumaBound(i-x, j-y) > bound || PatchBound(i-x, j-y) > min)
+				continue; // can not be a hit or can not be better by colour
+			long sum = LumaSAD(i, j, bound);
+			if(sum<=bound)
+			{
+				InsertHit(hits, hitsad, nhits, LUMA_HITS, j*m_width+i, sum);
+				TryPatch(x, y, i, j, min, best); // compare by colour
+			}
+		}
+	}
+}
+
+/*********************************************************************/
+long inpainting::LumaBound(int dx, int dy)
+{
+	// SEA lower bound of luma SAD by gray sums of blocks from TargetBlocks
+	long lb = 0;
+	for(int b = 0; b<m_nlumablocks; b++)
+	{
+		const block * bl = m_blocks + b;
+		const unsigned int * p00 = m_graysat + (bl->y0+dy)*(m_width+1) + bl->x0+dx;
+		const unsigned int * p10 = p00 + (bl->y1-bl->y0)*(m_width+1);
+		int w = bl->x1-bl->x0;
+		int s = (int)(p10[w] - p10[0] - p00[w] + p00[0]);
+		lb += abs(bl->gray - s);
+	}
+	return lb;
+}
+
+/*********************************************************************/
+long inpainting::LumaSAD(int i, int j, long bound)
+{
+	// masked SAD of gray rows cached by LumaSearch and source gray, stopped if sum exceeds bound.
+	// Rows are compared by 3 in one call of planes kernel (gray rows are width apart), since short gray rows
+	// cost about as much as rows of 3 planes in exact search
+	int n = winxsize*2;
+	long sum = 0;
+	int r = 0;
+	for(; r+3<=m_gny && sum<=bound; r += 3)
+		sum += sad.planes(m_gcache + r*n, m_gray + (j+m_gy0+r)*m_width + i-winxsize, m_gmcache + r*n, n, m_width);
+	for(; r<m_gny && sum<=bound; r++)
+		sum += sad.bytes(m_gcache + r*n, m_gray + (j+m_gy0+r)*m_width + i-winxsize, m_gmcache + r*n, n);
+	return sum;
+}
+
+/*********************************************************************/
+bool inpainting::PatchTexture(int x, int y, int &patch_x, int &patch_y)
+{
+	// find the most similar patch, according to SAD
+	// In exact mode result is the same as of full raster scan: minimal SAD, and first in raster order for equal SAD.
+
+	SortRows(x, y);
+	CacheTarget(x, y);
+
+	long min=MIN_INITIAL;
+	int best = -1; // raster index of best patch
+
+	// with adaptive radius search starts in small area, which is enlarged only if it has no valid source patch
+	int hole = (m_nholes>0) ? m_hole[y*m_width+x] : -1;
+	int maxradius = (hole>=0) ? m_holeradius[hole] : radius; // own radius of hole if estimated
+	if (maxradius<=0)
+		maxradius = MAX(m_width, m_height); // full frame search (slow)
+	int r = maxradius;
+	if (minradius>0)
+		r = MIN(minradius, maxradius);
+	int pxmin = 0, pxmax = 0, pymin = 0, pymax = 0; // area of previous step, its candidates are already compared
+
+	for(;;)
+	{
+		m_ymin = MAX(y-r, 0);
+		m_ymax = MIN(y+r, m_height);
+		m_xmin = MAX(x-r, 0);
+		m_xmax = MIN(x+r, m_width);
+		if (psrcarea) // restricted sources, shrink area to their bounding box
+		{
+			m_ymin = MAX(m_ymin, m_stop);
+			m_ymax = MIN(m_ymax, m_sbottom);
+			m_xmin = MAX(m_xmin, m_sleft);
+			m_xmax = MIN(m_xmax, m_sright);
+			if (m_xmin>=m_xmax || m_ymin>=m_ymax) // no sources in search area
+			{
+				if (r>=maxradius)
+					break;
+				r = MIN(r*2, maxradius);
+				continue;
+			}
+		}
+
+		// try first some candidates which are probably good, to get low min for early abort of others:
+		// shift of previous step patch (next target is usually near previous one) and nearest sources in 4 directions
+		if (m_lastdx != MIN_INITIAL)
+			TryPatch(x, y, x + m_lastdx, y + m_lastdy, min, best);
+		int s;
+		for(s = x-1; s>=m_xmin && m_source[y*m_width+s]==0; s--);
+		TryPatch(x, y, s, y, min, best);
+		for(s = x+1; s<m_xmax && m_source[y*m_width+s]==0; s++);
+		TryPatch(x, y, s, y, min, best);
+		for(s = y-1; s>=m_ymin && m_source[s*m_width+x]==0; s--);
+		TryPatch(x, y, x, s, min, best);
+		for(s = y+1; s<m_ymax && m_source[s*m_width+x]==0; s++);
+		TryPatch(x, y, x, s, min, best);
+
+		if (coherence>0) // coherent patches may be good enough to skip search
+		{
+			CoherentPatches(x, y, min, best);
+			if (best>=0 && min <= (long)coherence*KnownPixels())
+				break; // coherent patch is accepted
+		}
+
+		if (search_mode == SEARCH_PATCHMATCH)
+			PatchMatch(x, y, min, best);
+		else if (search_mode == SEARCH_SPIRAL)
+		{
+			TargetBlocks(x, y);
+			SpiralSearch(x, y, min, best);
+		}
+		else if (search_mode == SEARCH_PYRAMID && CoarseKnown(x, y)>0)
+			PyramidSearch(x, y, min, best); // (without known coarse pixels all coarse SAD are 0, so exact search is used)
+		else if (search_mode == SEARCH_LUMA)
+			LumaSearch(x, y, min, best);
+		else if (search_mode == SEARCH_FFT && FftCost() < (double)(m_xmax-m_xmin)*(m_ymax-m_ymin)*KnownPixels())
+			FftSearch(x, y, min, best); // it is cheaper than comparison of all candidates
+		else if (search_mode == SEARCH_ANN && (m_xmax-m_xmin)*(m_ymax-m_ymin)*4 >= m_width*m_height)
+			AnnSearch(x, y, min, best); // index is useful for large search area only, most of points are outside of small one
+		else if (stride>1)
+		{
+			TargetBlocks(x, y);
+			StrideSearch(x, y, min, best);
+		}
+		else
+		{
+			TargetBlocks(x, y);
+			// Search area is scanned by tiles of columns, so source rows of candidates of tile stay in cache
+			// for next candidate rows. Result does not depend on order, since equal SAD is resolved by raster index
+			// Bytes of source rows read per column: 3 planes of interleaved formats, luma and U, V rows of half width of YV12
+			int colbytes = m_planes ? 3*(winysize*2+1) : (pixel_format == YV12) ? (winysize*2+1) + (winysize+1) : 2*(winysize*2+1);
+			int tile = MAX(SEARCH_TILE/colbytes - winxsize*2, 16); // candidate columns
+			for(int i0 = m_xmin; i0<m_xmax; i0 += tile)
+			for(int j = m_ymin; j<m_ymax; j++)
+			{
+				// runs of valid source centres of row inside tile
+				int i1 = MIN(i0+tile, m_xmax);
+				bool inner = (j>=pymin && j<pymax); // row of area of previous step
+				for(int k = FirstRun(j, i0); k<m_rowruns[j+1] && m_runs[k*2]<i1; k++)
+				for(int i = MAX(m_runs[k*2], i0); i<MIN(m_runs[k*2+1], i1); i++)
+				{
+					if(inner && i>=pxmin && i<pxmax)
+					{
+						i = pxmax-1; // only new ring of enlarged area
+						continue;
+					}
+					if(PatchBound(i-x, j-y) > min)continue; // can not be better
+					long sum = PatchSAD(x, y, i, j, min); // will be > min if aborted
+					if(sum<min || (sum==min && j*m_width+i<best))
+					{
+						min=sum;
+						best = j*m_width+i;
+					}
+				}
+			}
+		}
+
+		if (r>=maxradius || best>=0)
+			break;
+		pxmin = m_xmin; // no valid source patch in area, enlarge it
+		pxmax = m_xmax;
+		pymin = m_ymin;
+		pymax = m_ymax;
+		r = MIN(r*2, maxradius);
+	}
+
+	if (best < 0)
+		return false; // patch not found
+
+	patch_x = best%m_width;
+	patch_y = best/m_width;
+	m_lastdx = patch_x - x; // remember shift for next step
+	m_lastdy = patch_y - y;
+	return true; // found
+}
+
+/*********************************************************************/
+bool inpainting::update(int target_x, int target_y, int source_x, int source_y, int confid)
+{
+	// apply patch, remember filled pixels
+
+	m_nfilled = 0;
+	if (m_usefenwick) // new confidence of pixels to be filled (dilated ones were not 0)
+		for(int y1 = target_y-winysize; y1<target_y+winysize; y1++)
+			for(int x1 = target_x-winxsize; x1<target_x+winxsize; x1++)
+				if(IS_TARGET(m_mark[y1*m_mpitch+x1]))
+					FenwickAdd(x1, y1, confid - m_confid[y1*m_mpitch+x1]);
+	if(pixel_format==RGB32 || pixel_format == RGBA)
+	{
+
+		unsigned int * intsrc = reinterpret_cast<unsigned int *>(psrc); // faster access
+		int intsrc_pitch = src_pitch/4; // in int
+
+		int x0,y0,x1,y1;
+		for(int iter_y=-winysize; iter_y<winysize; iter_y++) // outside pixels are not target
+		{
+				y0 = source_y+iter_y;
 				y1 = target_y + iter_y;
 
-			for(int iter_x=MAX(-winxsize, -target_x); iter_x<MIN(winxsize, m_width-target_x); iter_x++)// add bound check
+			for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
 			{
 				x0 = source_x+iter_x;
 				x1 = target_x + iter_x;
 
-				if(m_mark[y1*m_width+x1]!=SOURCE)
+				if(IS_TARGET(m_mark[y1*m_mpitch+x1]))
 				{
-					m_mark[y1*m_width+x1] = SOURCE; // now filled
+					m_mark[y1*m_mpitch+x1] = SOURCE; // now filled
+					m_filled[m_nfilled++] = y1*m_width+x1;
 					m_gray[y1*m_width+x1] = m_gray[y0*m_width+x0]; // inpaint the gray
-					m_confid[y1*m_width+x1] = confid; // update the confidence
+					m_confid[y1*m_mpitch+x1] = confid; // update the confidence
 					*(intsrc + y1*intsrc_pitch + x1) = *(intsrc + y0*intsrc_pitch + x0);// inpaint the color and alpha
+					for(int c=0; c<3; c++)
+						m_planes[(y1*3+c)*m_ppitch + x1] = m_planes[(y0*3+c)*m_ppitch + x0]; // and planes
 				}
 			}
 		}
@@ -1511,24 +2881,27 @@ bool inpainting::update(int target_x, int target_y, int source_x, int source_y,
 	{
 
 		int x0,y0,x1,y1;
-		for(int iter_y=MAX(-winysize, -target_y); iter_y<MIN(winysize, m_height-target_y); iter_y++)// add bound check - Fizick
+		for(int iter_y=-winysize; iter_y<winysize; iter_y++) // outside pixels are not target
 		{
 				y0 = source_y+iter_y;
 				y1 = target_y + iter_y;
 
-			for(int iter_x=MAX(-winxsize, -target_x); iter_x<MIN(winxsize, m_width-target_x); iter_x++)// add bound check
+			for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
 			{
 				x0 = source_x+iter_x;
 				x1 = target_x + iter_x;
 
-				if(m_mark[y1*m_width+x1]!=SOURCE)
+				if(IS_TARGET(m_mark[y1*m_mpitch+x1]))
 				{
-					m_mark[y1*m_width+x1] = SOURCE; // now filled
+					m_mark[y1*m_mpitch+x1] = SOURCE; // now filled
+					m_filled[m_nfilled++] = y1*m_width+x1;
 					m_gray[y1*m_width+x1] = m_gray[y0*m_width+x0]; // inpaint the gray
-					m_confid[y1*m_width+x1] = confid; // update the confidence
+					m_confid[y1*m_mpitch+x1] = confid; // update the confidence
 					*(psrc + y1*src_pitch + x1*3) = *(psrc + y0*src_pitch + x0*3);// inpaint the color B
 					*(psrc + y1*src_pitch + x1*3+1) = *(psrc + y0*src_pitch + x0*3+1);// inpaint the color G
 					*(psrc + y1*src_pitch + x1*3+2) = *(psrc + y0*src_pitch + x0*3+2);// inpaint the color R
+					for(int c=0; c<3; c++)
+						m_planes[(y1*3+c)*m_ppitch + x1] = m_planes[(y0*3+c)*m_ppitch + x0]; // and planes
 				}
 			}
 		}
@@ -1537,20 +2910,21 @@ bool inpainting::update(int target_x, int target_y, int source_x, int source_y,
 	{
 
 		int x0,y0,x1,y1;
-		for(int iter_y=MAX(-winysize, -target_y); iter_y<MIN(winysize, m_height-target_y); iter_y++)// add bound check - Fizick
+		for(int iter_y=-winysize; iter_y<winysize; iter_y++) // outside pixels are not target
 		{
 				y0 = source_y+iter_y;
 				y1 = target_y + iter_y;
 
-			for(int iter_x=MAX(-winxsize, -target_x); iter_x<MIN(winxsize, m_width-target_x); iter_x++)// add bound check
+			for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
 			{
 				x0 = source_x+iter_x;
 				x1 = target_x + iter_x;
 
-				if(m_mark[y1*m_width+x1]!=SOURCE)
+				if(IS_TARGET(m_mark[y1*m_mpitch+x1]))
 				{
-					m_mark[y1*m_width+x1] = SOURCE; // now filled
-					m_confid[y1*m_width+x1] = confid; // update the confidence
+					m_mark[y1*m_mpitch+x1] = SOURCE; // now filled
+					m_filled[m_nfilled++] = y1*m_width+x1;
+					m_confid[y1*m_mpitch+x1] = confid; // update the confidence
 					m_gray[y1*m_width+x1] = m_gray[y0*m_width+x0]; // inpaint the gray
 					int x04 = (x0>>1)<<2; // mult 4
 					int U = *(psrc + y0*src_pitch + x04 + 1);
@@ -1568,89 +2942,88 @@ bool inpainting::update(int target_x, int target_y, int source_x, int source_y,
 	{
 
 		int x0,y0,x1,y1;
-		for(int iter_y=MAX(-winysize, -target_y); iter_y<MIN(winysize, m_height-target_y); iter_y++)// add bound check - Fizick
+		for(int iter_y=-winysize; iter_y<winysize; iter_y++) // outside pixels are not target
 		{
 				y0 = source_y+iter_y;
 				y1 = target_y + iter_y;
 
-			for(int iter_x=MAX(-winxsize, -target_x); iter_x<MIN(winxsize, m_width-target_x); iter_x++)// add bound check
+			for(int iter_x=-winxsize; iter_x<winxsize; iter_x++)
 			{
 				x0 = source_x+iter_x;
 				x1 = target_x + iter_x;
 
-				if(m_mark[y1*m_width+x1]!=SOURCE)
+				if(IS_TARGET(m_mark[y1*m_mpitch+x1]))
 				{
-					m_mark[y1*m_width+x1] = SOURCE; // now filled
-					m_confid[y1*m_width+x1] = confid; // update the confidence
+					m_mark[y1*m_mpitch+x1] = SOURCE; // now filled
+					m_filled[m_nfilled++] = y1*m_width+x1;
+					m_confid[y1*m_mpitch+x1] = confid; // update the confidence
 					*(psrc + y1*src_pitch + x1) = *(psrc + y0*src_pitch + x0);// inpaint Y
-					// gray is impainted as luma Y
+					m_gray[y1*m_width+x1] = m_gray[y0*m_width+x0]; // inpaint the gray (copy of luma)
 					*(psrcU + (y1>>1)*src_pitchUV + (x1>>1)) = *(psrcU + (y0>>1)*src_pitchUV + (x0>>1));// inpaint the U
 					*(psrcV + (y1>>1)*src_pitchUV + (x1>>1)) = *(psrcV + (y0>>1)*src_pitchUV + (x0>>1));// inpaint the V
 				}
 			}
 		}
 	}
+	m_ntargets -= m_nfilled;
 	return true;
 }
 
 /*********************************************************************/
 bool inpainting::TargetExist(void)
 {
-		for(int j= m_top; j<=m_bottom; j++)
-			for(int i = m_left; i<= m_right; i++)
-				if(m_mark[j*m_width+i]!=SOURCE)
-					return true;
-	return false;
+	return m_ntargets > 0;
 }
 
 /*********************************************************************/
-void inpainting::UpdateBoundary(int i, int j)// just update the area near the changed patch. (+-2 pixels)
+void inpainting::UpdateBoundary(void)// just update the area near the filled pixels
 {
-	int x, y;
-
-	for(y = MAX(j -winysize-2,0); y< MIN(j+winysize+2,m_height); y++)
-		for( x = MAX(i-winxsize-2,0); x<MIN(i+winxsize+2, m_width); x++)
-		{
-            if (m_mark[y*m_width+x]!=SOURCE)// was target or boundary and was not patched
-			    m_mark[y*m_width+x] = TARGET;
-		}
-
-	for(y = MAX(j -winysize-2,0); y< MIN(j+winysize+2,m_height); y++)
-		for( x = MAX(i-winxsize-2,0); x<MIN(i+winxsize+2, m_width); x++)
-		{
-			if(m_mark[y*m_width+x]==TARGET)
-			{
-				if(y==m_height-1||y==0||x==0||x==m_width-1
-					|| m_mark[(y-1)*m_width+x]==SOURCE || m_mark[y*m_width+x-1]==SOURCE
-					|| m_mark[y*m_width+x+1]==SOURCE || m_mark[(y+1)*m_width+x]==SOURCE)
-				{
-
-						m_mark[y*m_width+x] = BOUNDARY;
-				}
-			}
-		}
+	// boundary pixel stays boundary until it is filled, so only target neighbours of filled pixels become boundary
+	for(int k = 0; k<m_nfilled; k++)
+	{
+		unsigned char * pmark = m_mark + (m_filled[k]/m_width)*m_mpitch + m_filled[k]%m_width;
+		if(pmark[-m_mpitch]==TARGET)
+			pmark[-m_mpitch] = BOUNDARY;
+		if(pmark[-1]==TARGET)
+			pmark[-1] = BOUNDARY;
+		if(pmark[1]==TARGET)
+			pmark[1] = BOUNDARY;
+		if(pmark[m_mpitch]==TARGET)
+			pmark[m_mpitch] = BOUNDARY;
+	}
 }
 
 /*********************************************************************/
-int inpainting::UpdatePri(int i, int j) // just update the area near the changed patch. (+-3 pixels)
+int inpainting::UpdatePri(void) // just update priority of boundary pixels which depend on the changed area
 {
-	int x,y;
-	int max_pri_new = -1; // init as not valid
-	for(y = MAX(j -winysize-3,0); y< MIN(j+winysize+3,m_height); y++)
-		for( x = MAX(i-winxsize-3,0); x<MIN(i+winxsize+3, m_width); x++)
-			if(m_mark[y*m_width+x] == BOUNDARY)
+	// dirty area: pixels filled by last update (mark, confidence and gray are changed) and their neighbours,
+	// which may become boundary (mark) or whose gradients are changed (gray and marks of neighbours)
+	int left = m_width, right = 0, top = m_height, bottom = 0;
+	for(int k = 0; k<m_nfilled; k++)
+	{
+		int x = m_filled[k]%m_width;
+		int y = m_filled[k]/m_width;
+		left = MIN(left, x-1);
+		right = MAX(right, x+2);
+		top = MIN(top, y-1);
+		bottom = MAX(bottom, y+2);
+	}
+	// priority of pixel depends on its patch window (confidence, data term) and its neighbours (norm),
+	// so pixels with patch intersecting dirty area are updated, boundary marks are changed only there too, so heap is synchronized here
+	left = MAX(left-winxsize, 0);
+	right = MIN(right+winxsize, m_width);
+	top = MAX(top-winysize, 0);
+	bottom = MIN(bottom+winysize, m_height);
+	for(int y = top; y<bottom; y++)
+		for(int x = left; x<right; x++)
+			if(m_mark[y*m_mpitch+x] == BOUNDARY)
 			{
-				int pri = priority(x,y);
-				m_pri[y*m_width+x] = pri;
-				if (pri >= max_pri) // if new local pri is greater than old max in same block,
-				{ // therefore there is no need in slow global search (Fizick)
-					max_pri_new = pri; // get new max here
-					max_pri = pri; // update new max here
-					pri_x = x; // and location of the max
-					pri_y = y;
-				}
+				m_pri[y*m_width+x] = priority(x,y);
+				HeapSet(y*m_width+x);
 			}
+			else
+				HeapRemove(y*m_width+x); // filled or not boundary anymore
 
-	return max_pri_new; // valid if >= 0 only
+	return HighestPriority(); // new max with pri_x and pri_y, -1 if no boundary
 
 }
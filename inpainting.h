@@ -11,16 +11,42 @@
 #ifndef INPAINTING_H
 #define INPAINTING_H
 
+#include "sad.h"
+
 #define SOURCE 0
 #define TARGET 1
 #define BOUNDARY 2
 #define ERODED 4
 #define ERODEDNEXT 8
+#define OUTSIDE 16 // apron of mark map around frame, neither source nor target
 //#define WINSIZE 4  // the window size
 
-// switch ISSE optimizaton:
+// switch ISSE optimizaton of YUY2 conversion (inline MMX assembler, MSVC 32 bit only),
+// PatchTexture uses SIMD kernels from sad.cpp selected at runtime
 #define ISSE 0
 
+// search modes
+#define SEARCH_EXACT 0 // full scan of search area
+#define SEARCH_PATCHMATCH 1 // approximate nearest neighbour field search
+#define SEARCH_ANN 2 // approximate nearest neighbours by index of source patches
+#define SEARCH_FFT 3 // search by SSD as correlation via FFT, best ones compared by SAD
+#define SEARCH_PYRAMID 4 // coarse to fine search
+#define SEARCH_SPIRAL 5 // search from target outwards until good enough patch
+#define SEARCH_LUMA 6 // scan by luma, best ones compared by colour
+
+#define PYR_HITS 4 // best coarse patches refined in full resolution
+#define STRIDE_HITS 4 // best patches of strided scan refined by full search around
+#define LUMA_HITS 8 // best patches by luma compared by colour
+#define FFT_HITS 4 // best patches by SSD compared by SAD
+#define FFT_TILE 4 // FFT size of source tiles is not less than this number of patch sizes
+#define FFT_COST 64 // cost of FFT per tile pixel and its log2 size, relative to comparison of pixel in exact search (which is pruned by SEA bound)
+#define SEARCH_TILE 32768 // bytes of source rows of tile of candidates in exact search (L1 cache)
+
+// index of source patches for SEARCH_ANN
+#define ANN_GRID 4 // cells of patch descriptor in every direction
+#define ANN_DIMS 8 // principal components of descriptor
+#define ANN_SHORTLIST 32 // nearest patches re-ranked by exact SAD
+
 // pixel_formats
 #define RGBA 33
 #define RGB32 32
@@ -47,6 +73,20 @@ typedef struct
 	int y;
 }bound;  // the structure that record the boundary
 
+typedef struct
+{
+	int x0, y0, x1, y1; // rectangle [x0,x1) * [y0,y1)
+	int sum[3]; // sums of target channels in it
+	int gray; // sum of target gray (luma search only)
+}block;  // the structure that record block of known target pixels
+
+typedef struct
+{
+	int r, k; // cached chroma row and sample in it
+	int w; // number of known luma pixels (1-3)
+	int u, v; // target chroma
+}csample;  // the structure that record partially known chroma sample of YV12 target patch
+
 class inpainting
 {
 public:
@@ -71,15 +111,102 @@ public:
 	int winxsize;
 	int winysize;
 	int radius; // search radius (0 - full frame)
+	int search_mode; // SEARCH_EXACT, SEARCH_PATCHMATCH, SEARCH_ANN, SEARCH_FFT, SEARCH_PYRAMID, SEARCH_SPIRAL or SEARCH_LUMA
+	int iterations; // random search iterations of PatchMatch
+	int coherence; // SAD per known pixel to accept coherent patch without search (0 - always search)
+	int stride; // step of candidates in exact search mode (1 - all)
+	int accept; // SAD per known pixel of good enough patch to stop spiral search (0 - never)
+	int minradius; // initial radius of adaptive search, enlarged if there is no valid source patch (0 - not adaptive)
+	const unsigned char * psrcarea; // frame of source area clip (same format), centres of source patches at its bright pixels only (0 - all)
+	int srcarea_pitch;
 
 	int m_top, m_bottom, m_left, m_right; // the rectangle of inpaint area
 
 
 	unsigned char * m_mark;// mark it as source or to-be-inpainted target area or boundary.
 	int * m_confid;// record the confidence for every pixel
+	unsigned char * m_markbuf; // mark map with apron (OUTSIDE) around frame, m_mark points to its pixel (0,0)
+	int * m_confidbuf; // same for confidence (0 in apron)
+	int m_apron; // apron size, not less than half patch + 3, so loops near patch do not check frame borders
+	int m_mpitch; // pitch of mark and confidence maps
+	unsigned int * m_fenwick; // 2D Fenwick (binary indexed) tree of confidence of frame, (m_width+1)*(m_height+1)
+	bool m_usefenwick; // window sums by tree (for large patches), or by direct summation
 	int * m_pri; // record the priority for pixels. only boudary pixels will be used
+	int * m_heap; // indexed binary max-heap of boundary pixels (raster index) by priority, first in raster order for equal
+	int * m_heappos; // position of pixel in heap, -1 if not in heap
+	int m_nheap; // number of pixels in heap
 	unsigned char * m_gray; // the gray image
+	long long * m_gradrow; // greatest gradient key (see GradientKey) in row of patch width around pixel
+	long long * m_gradmax; // the same in patch around pixel (from rows of patch height)
+	long long * m_slidebuf; // line with window, its prefix and suffix maxima
+	bool m_usegradmap; // data term by gradient maps (for large patches), or by scan of patch
+	unsigned char * m_planebuf; // allocated planes
+	unsigned char * m_planes; // aligned planar copy of 3 channels of interleaved formats, channel c of row y at (y*3+c)*m_ppitch
+	int m_ppitch; // pitch of one plane row, multiple of 64
 	unsigned char * m_source; // whether this pixel can be used as an example texture center
+	int * m_runs; // runs (first, end) of valid source centres, by rows
+	int * m_rowruns; // index of first run of every row (and number of runs at m_height)
+	int m_sleft, m_sright, m_stop, m_sbottom; // bounding box of valid source centres (right and bottom excluded)
+
+	sadkernels sad; // SAD row kernels for current CPU
+
+	int * m_rows; // patch rows (iter_y) in order of SAD summation, for current target
+	int * m_rowknown; // number of known pixels in these rows
+	int m_nrows;
+	int m_lastdx, m_lastdy; // shift from target to source patch at previous step
+	unsigned int * m_sat; // integral images of 3 channels (interleaved), (m_width+1)*(m_height+1)
+	unsigned int * m_graysat; // integral image of gray for luma search, 0 if not used
+	block * m_blocks; // blocks of known pixels of current target patch
+	int m_nblocks, m_maxblocks;
+	int m_nlumablocks; // blocks of pixels, others are blocks of chroma samples of YV12
+	int m_blockx, m_blocky; // target of blocks
+	unsigned char * m_tcachebuf, * m_mcachebuf; // allocated caches
+	unsigned char * m_tcache; // premasked target patch rows of current search (RGB formats)
+	unsigned char * m_mcache; // masks of known bytes of them
+	int m_tcache_pitch; // bytes in cached row, 0 if not cached
+	unsigned char * m_gcache, * m_gmcache; // premasked gray rows of target patch and their masks for luma search (second half of caches)
+	int m_gy0, m_gny; // first cached gray row (relative to target) and number of rows
+	int m_tcache_pitchUV; // chroma samples in cached U (and V) row of YV12, after luma rows
+	int * m_crows; // cached chroma rows of YV12 (relative to first chroma row inside target patch)
+	int m_ncrows;
+	csample * m_csamples; // partially known chroma samples of cached rows
+	int m_ncsamples;
+	int m_xmin, m_xmax, m_ymin, m_ymax; // search rectangle of current target
+	int * m_hole; // number of hole (4-connected target area) of target pixels, -1 for others
+	int * m_holequeue; // pixels of hole for its erosion
+	int * m_holeradius; // estimated search radius of every hole, 0 for full frame
+	int m_nholes, m_maxholes; // 0 holes if radius is not estimated
+	int * m_nnf; // nearest neighbour field: raster index of source patch for target (and filled) pixels, -1 unknown
+	unsigned int m_random; // state of pseudo-random generator
+	int * m_coherent; // coherent candidates of current target
+	int * m_filled; // pixels (raster index) filled by last update
+	int m_nfilled;
+	int m_ntargets; // number of target pixels left
+	int m_ann_count; // number of indexed source patches, -1 if index is not built for frame
+	int * m_ann_index; // raster index of indexed source patches, in kd-tree order
+	float * m_ann_points; // their projections to principal components, ANN_DIMS per patch
+	unsigned char * m_ann_split; // split dimension of kd-tree node (middle of range)
+	int m_ann_gx, m_ann_gy; // number of descriptor cells
+	int m_ann_x[ANN_GRID+1], m_ann_y[ANN_GRID+1]; // cell borders relative to patch center
+	float m_ann_mean[ANN_GRID*ANN_GRID*3]; // mean descriptor
+	float m_ann_basis[ANN_DIMS][ANN_GRID*ANN_GRID*3]; // principal components
+	int m_ann_best[ANN_SHORTLIST]; // shortlist of nearest patches of current query
+	float m_ann_dist[ANN_SHORTLIST];
+	int m_ann_nbest;
+	int m_fft_n; // FFT size of source tiles and target template (power of 2), 0 if not allocated
+	int m_fft_logn; // its log2
+	int m_fft_sx, m_fft_sy; // distance of tiles, they overlap by patch size
+	int m_fft_tx, m_fft_ty; // number of tiles in row and column
+	double ** m_fft_tile; // spectra of source channels 0 + i*1 and channel 2 + i*(sum of squares) of tiles, allocated when used
+	unsigned char * m_fft_done; // spectra of tile are computed for frame
+	double * m_fft_t1, * m_fft_t2; // same for masked target template
+	double * m_fft_corr; // correlation of target template with tile
+	double * m_fft_roots; // roots of unity
+	int m_pyr_scale; // downsampling of coarse frame (2 or 4)
+	int m_pyr_w, m_pyr_h; // coarse frame size
+	unsigned char * m_pyr; // coarse frame, 3 channels per pixel
+	unsigned char * m_pyr_mark; // 1 for known coarse pixels
+	bool m_pyr_ready; // coarse frame is computed
 
 	int max_pri; // value of max priority
 	int pri_x; // location of max priority
@@ -97,21 +224,67 @@ public:
 						const unsigned char * _maskpV,
 						int _xsize, int _ysize, int _radius, int _maskcolor, int _dilateflags, int _maxsteps);
 	int HighestPriority(void);
-	int EstimateRadius(void);// estimate redius by iterative erosion
+	void HeapUp(int k); // restore heap order after priority of heap item k increased
+	void HeapDown(int k); // and decreased
+	void HeapSet(int n); // insert boundary pixel n to heap or update it for its new priority
+	void HeapRemove(int n); // remove pixel n from heap if it is there
+	int EstimateRadius(void);// estimate radius of every hole by erosion
 	void DrawBoundary(void);  // the first time to draw boundary on the image.
 	void GetMask(void);// fist time mask
 	int ComputeConfidence(int i, int j); // the function to compute confidence
+	void BuildFenwick(void); // tree of initial confidence
+	void FenwickAdd(int x, int y, int delta); // add to confidence of pixel
+	unsigned int FenwickSum(int x, int y); // sum of confidence of rectangle (0,0)-(x,y), excluded
 	int priority(int x, int y); // the function to compute priority
 	int ComputeData(int i, int j);//the function to compute data item
+	long long GradientKey(int x, int y); // key of pixel gradient for data term
+	void GradientMap(int left, int top, int right, int bottom); // update gradient maps for changed rectangle (right, bottom excluded)
+	void SlidingMax(const long long * in, long long * out, int outstride, int n, int len); // max in windows of line
 	void Convert2Gray(void);  // convert the input image to gray image
 	gradient GetGradient(int i, int j); // calculate the gradient at one pixel
 	norm GetNorm(int i, int j);  // calculate the norm at one pixel
 	bool draw_source(void);  // find out all the pixels that can be used as an example texture center
+	void SplitPlanes(void); // de-interleave frame to planes
 	bool PatchTexture(int x, int y,int &patch_x,int &patch_y);// find the most similar patch from sources.
+	void SortRows(int x, int y); // order of target patch rows for PatchSAD
+	void CacheTarget(int x, int y); // cache premasked target patch rows for PatchSAD
+	long PatchSAD(int x, int y, int i, int j, long bound); // SAD of target and source patches, stopped if > bound
+	void PixelChannels(int x, int y, int *c); // get 3 channels of pixel
+#ifdef _DEBUG
+	long PixelSAD(int x, int y, int i, int j); // SAD of 3 channels of every known pixel (YV12 check)
+#endif
+	void Integrate(void); // integral images of channels
+	void TargetBlocks(int x, int y); // blocks of known pixels of target patch for PatchBound
+	long PatchBound(int dx, int dy); // SEA lower bound of SAD for source patch shifted by dx, dy
+	int FirstRun(int j, int x); // first run of valid source centres in row j which ends after x
+	bool TryPatch(int x, int y, int i, int j, long &min, int &best); // compare valid source patch, remember if better
+	int Random(int n); // pseudo-random number 0..n-1
+	void PatchMatch(int x, int y, long &min, int &best); // approximate search by nearest neighbour field
+	void CoherentPatches(int x, int y, long &min, int &best); // try sources coherent with filled pixels of target patch
+	void PatchDescriptor(int i, int j, float *d); // cell means of source patch
+	void BuildIndex(void); // index of valid source patches for SEARCH_ANN
+	void BuildTree(int lo, int hi); // kd-tree of range of indexed patches
+	void SearchTree(int lo, int hi, const float *q); // nearest indexed patches to shortlist
+	void AnnSearch(int x, int y, long &min, int &best); // approximate search by index
+	void FFT2(double *a, int rows, bool inverse); // 2D FFT of tile with first rows not zero
+	void FftInit(void); // tiles of frame for patch size
+	void FftTile(int tile); // spectra of source channels of tile
+	double FftCost(void); // estimated cost of FftSearch in current search area
+	void FftSearch(int x, int y, long &min, int &best); // search by SSD via FFT
+	void UpdatePyramid(int left, int top, int right, int bottom); // recompute coarse pixels of rectangle
+	int CoarseKnown(int x, int y); // known coarse pixels of target patch (builds coarse frame)
+	void PyramidSearch(int x, int y, long &min, int &best); // coarse to fine search
+	void StrideSearch(int x, int y, long &min, int &best); // strided scan and refinement
+	int KnownPixels(void); // number of known pixels in target patch
+	void SpiralSearch(int x, int y, long &min, int &best); // search by rings from target
+	void LumaSearch(int x, int y, long &min, int &best); // luma scan, its hits are compared by colour
+	long LumaBound(int dx, int dy); // SEA lower bound of luma SAD
+	long LumaSAD(int i, int j, long bound); // masked luma SAD by gray rows cached by LumaSearch
+	void UpdateField(int target_x, int target_y, int source_x, int source_y); // record source of filled pixels
 	bool update(int target_x, int target_y, int source_x, int source_y, int confid);// inpaint this patch and update pixels' confidence within this area
 	bool TargetExist(void);// test whether this is still some area to be inpainted.
-	void UpdateBoundary(int i, int j);// update boundary
-	int UpdatePri(int i, int j); //update priority for boundary pixels.
+	void UpdateBoundary(void);// update boundary near filled pixels
+	int UpdatePri(void); //update priority for boundary pixels.
     void Dilate(int dilateflags);// dilate the mask by 1 pixel
 };
 
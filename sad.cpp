@@ -0,0 +1,305 @@
+/* Masked SAD kernels for Exemplar-Based Inpainting
+
+    This program is free software; you can rrdistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Row kernels of masked SAD used by PatchTexture, selected at startup by CPUID.
+   They replace old MSVC-only inline MMX assembler and give exactly the same sum as plain C code.
+   Every kernel processes its full vector steps, then passes the rest of row to lower level kernel.
+   Loads never read outside of compared pixels.
+   Planes kernels sum rows of 3 planes in one call (AVX-512 uses masked loads for rest of row).
+*/
+
+#include "sad.h"
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+	#if defined(_MSC_VER)
+		#if (_MSC_VER >= 1700)
+			#define SAD_USE_AVX2 1
+		#endif
+		#if (_MSC_VER >= 1911)
+			#define SAD_USE_AVX512 1
+		#endif
+		#include <intrin.h>
+		#define SAD_USE_SSE2 1
+	#elif defined(__GNUC__) // gcc and clang
+		#if defined(__clang__) || (__GNUC__ >= 5)
+			#define SAD_USE_AVX2 1
+		#endif
+		#if defined(__clang__) || (__GNUC__ >= 7)
+			#define SAD_USE_AVX512 1
+		#endif
+		#include <cpuid.h>
+		#define SAD_USE_SSE2 1
+	#endif
+#endif
+
+#if (SAD_USE_SSE2)
+#include <immintrin.h>
+#endif
+
+// gcc and clang need target attribute to compile intrinsics without global -mavx2 etc
+#if defined(__GNUC__)
+#define SAD_TARGET(x) __attribute__((target(x)))
+#else
+#define SAD_TARGET(x)
+#endif
+
+/*********************************************************************/
+// plain C kernels, the same code as in PatchTexture middle part before (bytes kernel is for cached rows)
+
+static int sadbytes_c(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n)
+{
+	int sum = 0;
+	for(int k = 0; k<n; k++)
+		sum += abs((int)t[k] - (s[k] & m[k]));
+	return sum;
+}
+
+static int sadplanes_c(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n, int spitch)
+{
+	return sadbytes_c(t, s, m, n) + sadbytes_c(t+n, s+spitch, m+n, n) + sadbytes_c(t+n*2, s+spitch*2, m+n*2, n);
+}
+
+#if (SAD_USE_SSE2)
+/*********************************************************************/
+// SSE2 kernels
+
+SAD_TARGET("sse2")
+static inline int hsum_sse2(__m128i acc) // add two 64 bit psadbw sums
+{
+	return _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+}
+
+SAD_TARGET("sse2")
+static int sadbytes_sse2(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n)
+{
+	__m128i acc = _mm_setzero_si128();
+	int k = 0;
+	for(; k+16<=n; k+=16)
+	{
+		__m128i sm = _mm_and_si128(_mm_loadu_si128((const __m128i *)(s + k)), _mm_loadu_si128((const __m128i *)(m + k)));
+		acc = _mm_add_epi32(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(t + k)), sm));
+	}
+	if (k+8<=n) // half vector (short rows of one plane)
+	{
+		__m128i sm = _mm_and_si128(_mm_loadl_epi64((const __m128i *)(s + k)), _mm_loadl_epi64((const __m128i *)(m + k)));
+		acc = _mm_add_epi32(acc, _mm_sad_epu8(_mm_loadl_epi64((const __m128i *)(t + k)), sm));
+		k += 8;
+	}
+	return hsum_sse2(acc) + sadbytes_c(t+k, s+k, m+k, n-k);
+}
+
+SAD_TARGET("sse2")
+static int sadplanes_sse2(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n, int spitch)
+{
+	__m128i acc = _mm_setzero_si128();
+	int sum = 0;
+	for(int c = 0; c<3; c++, t += n, s += spitch, m += n)
+	{
+		int k = 0;
+		for(; k+16<=n; k+=16)
+		{
+			__m128i sm = _mm_and_si128(_mm_loadu_si128((const __m128i *)(s + k)), _mm_loadu_si128((const __m128i *)(m + k)));
+			acc = _mm_add_epi32(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(t + k)), sm));
+		}
+		if (k<n)
+			sum += sadbytes_c(t+k, s+k, m+k, n-k);
+	}
+	return hsum_sse2(acc) + sum;
+}
+
+#endif // SAD_USE_SSE2
+
+#if (SAD_USE_AVX2)
+/*********************************************************************/
+// AVX2 kernels
+
+SAD_TARGET("avx2")
+static inline int hsum_avx2(__m256i acc) // add four 64 bit psadbw sums
+{
+	__m128i a = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	return _mm_cvtsi128_si32(a) + _mm_cvtsi128_si32(_mm_srli_si128(a, 8));
+}
+
+SAD_TARGET("avx2")
+static int sadbytes_avx2(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	int k = 0;
+	for(; k+32<=n; k+=32)
+	{
+		__m256i sm = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(s + k)), _mm256_loadu_si256((const __m256i *)(m + k)));
+		acc = _mm256_add_epi32(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(t + k)), sm));
+	}
+	int sum = hsum_avx2(acc);
+	_mm256_zeroupper(); // avoid AVX-SSE transition penalty in lower level kernel
+	return sum + sadbytes_sse2(t+k, s+k, m+k, n-k);
+}
+
+SAD_TARGET("avx2")
+static int sadplanes_avx2(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n, int spitch)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m128i acc16 = _mm_setzero_si128();
+	int sum = 0;
+	for(int c = 0; c<3; c++, t += n, s += spitch, m += n)
+	{
+		int k = 0;
+		for(; k+32<=n; k+=32)
+		{
+			__m256i sm = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(s + k)), _mm256_loadu_si256((const __m256i *)(m + k)));
+			acc = _mm256_add_epi32(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(t + k)), sm));
+		}
+		if (k+16<=n) // half vector
+		{
+			__m128i sm = _mm_and_si128(_mm_loadu_si128((const __m128i *)(s + k)), _mm_loadu_si128((const __m128i *)(m + k)));
+			acc16 = _mm_add_epi32(acc16, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(t + k)), sm));
+			k += 16;
+		}
+		if (k<n)
+			sum += sadbytes_c(t+k, s+k, m+k, n-k);
+	}
+	acc = _mm256_add_epi32(acc, _mm256_castsi128_si256(acc16));
+	sum += hsum_avx2(acc);
+	_mm256_zeroupper();
+	return sum;
+}
+
+#endif // SAD_USE_AVX2
+
+#if (SAD_USE_AVX512)
+/*********************************************************************/
+// AVX-512 kernels
+
+SAD_TARGET("avx512f")
+static inline int hsum_avx512(__m512i acc) // add eight 64 bit psadbw sums
+{
+	// by memory, since extract and reduce intrinsics give false uninitialized warnings in some GCC headers
+	long long v[8];
+	_mm512_storeu_si512(v, acc);
+	return (int)(v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7]);
+}
+
+SAD_TARGET("avx512f,avx512bw")
+static int sadbytes_avx512(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n)
+{
+	// rest of row is loaded by masked loads, as in planes kernel
+	__m512i acc = _mm512_setzero_si512();
+	for(int k = 0; k<n; k+=64)
+	{
+		__mmask64 km = (n-k >= 64) ? ~(__mmask64)0 : (((__mmask64)1 << (n-k)) - 1);
+		__m512i sm = _mm512_and_si512(_mm512_maskz_loadu_epi8(km, s + k), _mm512_maskz_loadu_epi8(km, m + k));
+		acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_maskz_loadu_epi8(km, t + k), sm));
+	}
+	int sum = hsum_avx512(acc);
+	_mm256_zeroupper();
+	return sum;
+}
+
+SAD_TARGET("avx512f,avx512bw")
+static int sadplanes_avx512(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n, int spitch)
+{
+	// rest of row is loaded by masked loads (masked bytes are not read), so any width is one pass
+	__m512i acc = _mm512_setzero_si512();
+	for(int c = 0; c<3; c++, t += n, s += spitch, m += n)
+		for(int k = 0; k<n; k+=64)
+		{
+			__mmask64 km = (n-k >= 64) ? ~(__mmask64)0 : (((__mmask64)1 << (n-k)) - 1);
+			__m512i sm = _mm512_and_si512(_mm512_maskz_loadu_epi8(km, s + k), _mm512_maskz_loadu_epi8(km, m + k));
+			acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_maskz_loadu_epi8(km, t + k), sm));
+		}
+	int sum = hsum_avx512(acc);
+	_mm256_zeroupper();
+	return sum;
+}
+
+#endif // SAD_USE_AVX512
+
+/*********************************************************************/
+#if (SAD_USE_SSE2)
+static void cpuid(int regs[4], int leaf, int subleaf)
+{
+#if defined(_MSC_VER)
+	__cpuidex(regs, leaf, subleaf);
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+	regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+}
+
+static unsigned int xgetbv0(void) // OS support of saving registers (XCR0)
+{
+#if defined(_MSC_VER)
+	return (unsigned int)_xgetbv(0);
+#else
+	unsigned int a, d;
+	__asm__ volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return a;
+#endif
+}
+#endif
+
+int sad_cpulevel(void)
+{
+	int level = SAD_PLAIN;
+#if (SAD_USE_SSE2)
+	int regs[4];
+	cpuid(regs, 0, 0);
+	int maxleaf = regs[0];
+	cpuid(regs, 1, 0);
+	if (regs[3] & (1<<26)) // SSE2
+		level = SAD_SSE2;
+	bool osxsave = (regs[2] & (1<<27)) && (regs[2] & (1<<28)); // OSXSAVE and AVX
+	if (osxsave && maxleaf >= 7)
+	{
+		unsigned int xcr0 = xgetbv0();
+		cpuid(regs, 7, 0);
+		if ((xcr0 & 0x06) == 0x06 && (regs[1] & (1<<5))) // YMM state and AVX2
+			level = SAD_AVX2;
+		if (level == SAD_AVX2 && (xcr0 & 0xE6) == 0xE6 && (regs[1] & (1<<16)) && (regs[1] & (1<<30))) // ZMM state, AVX512F, AVX512BW
+			level = SAD_AVX512;
+	}
+#endif
+	return level;
+}
+
+void sad_getkernels(sadkernels *k, int level)
+{
+	k->bytes = sadbytes_c;
+	k->planes = sadplanes_c;
+#if (SAD_USE_SSE2)
+	if (level >= SAD_SSE2)
+	{
+		k->bytes = sadbytes_sse2;
+		k->planes = sadplanes_sse2;
+	}
+#endif
+#if (SAD_USE_AVX2)
+	if (level >= SAD_AVX2)
+	{
+		k->bytes = sadbytes_avx2;
+		k->planes = sadplanes_avx2;
+	}
+#endif
+#if (SAD_USE_AVX512)
+	if (level >= SAD_AVX512)
+	{
+		k->bytes = sadbytes_avx512;
+		k->planes = sadplanes_avx512;
+	}
+#endif
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+/* Masked SAD kernels for Exemplar-Based Inpainting (part of ExInpaint, under GNU GPL) */
+
+#ifndef SAD_H
+#define SAD_H
+
+// SIMD levels, detected at startup by CPUID
+#define SAD_PLAIN 0
+#define SAD_SSE2 1
+#define SAD_AVX2 2
+#define SAD_AVX512 3
+
+// SAD of n bytes of premasked target row t (cached, unknown bytes are zero) and source row s masked by m
+// (m is 0xFF for known bytes, 0 for others), used for interleaved RGB formats and YV12 planes
+typedef int (*sadbytes_fn)(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n);
+
+// the same for row of 3 planes: t and m are 3 cached rows of n bytes, planes of source row s are spitch apart
+typedef int (*sadplanes_fn)(const unsigned char *t, const unsigned char *s, const unsigned char *m, int n, int spitch);
+
+typedef struct
+{
+	sadbytes_fn bytes;
+	sadplanes_fn planes;
+}sadkernels; // the set of row kernels for one SIMD level
+
+int sad_cpulevel(void); // best SIMD level supported by CPU, OS and compiler
+void sad_getkernels(sadkernels *k, int level); // fill kernels for given level (or lower if not compiled)
+
+#endif